@@ -0,0 +1,21 @@
+#!/bin/sh
+# Writes a PPL program with N integer identifiers, all read once per loop
+# iteration, to stdout. Usage: gen_many_ids.sh [N] [ITERATIONS] > many_ids.ppl
+N=${1:-4000}
+ITER=${2:-200}
+awk -v n="$N" -v iter="$ITER" 'BEGIN {
+    for (i = 0; i < n; i++) print "INTEGER v" i
+    print "INTEGER acc"
+    print "INTEGER r"
+    print "INTEGER m1"
+    print "INTEGER z"
+    print "ASSIGN r " iter
+    print "ASSIGN m1 -1"
+    for (i = 0; i < n; i++) print "ASSIGN v" i " " (i % 97)
+    loop = 2 * n + 7
+    for (i = 0; i < n; i++) print "ADD acc v" i
+    print "ADD r m1"
+    print "IF r " (loop + n + 3)
+    print "IF z " loop
+    print "HLT"
+}'
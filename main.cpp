@@ -1,433 +1,5112 @@
 // main.cpp
 // PPL interpreter (single-file) - C++11
 
+#include "ppl.h"
+
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include <vector>
 #include <map>
 #include <memory>
 #include <algorithm>
 #include <cctype>
+#include <climits>
 #include <stdexcept>
+#include <exception>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <fstream>
+#include <unordered_map>
+#include <csignal>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
 
 using namespace std;
+// Two's-complement int arithmetic, shared with the generated C++
+using ppl::native::wrap_add;
+using ppl::native::wrap_sub;
+using ppl::native::wrap_neg;
+
+// PPL_INLINE: small helpers every dispatch handler goes through. GCC stops
+// inlining these once the translation unit grows, which costs a call per
+// list assignment in the engines. PPL_SLOW: an out-of-line path the common
+// case branches around.
+#if defined(__GNUC__)
+#define PPL_COLD __attribute__((noinline, noreturn, cold))
+#define PPL_SLOW __attribute__((noinline, cold))
+#define PPL_INLINE __attribute__((always_inline)) inline
+#else
+#define PPL_COLD
+#define PPL_SLOW
+#define PPL_INLINE inline
+#endif
 
 // Forward
 struct Value;
+struct BigInt;
 struct ListNode;
-typedef shared_ptr<ListNode> ListPtr;
+struct IntChunk;
+struct ListArena;
+
+// Raw reference to the first cell of a list; 0 is the empty list. A cell is
+// either a boxed ListNode holding any Value (even address) or one slot of an
+// IntChunk (slot address + 1), so runs of ints are stored contiguously.
+typedef uintptr_t ListRef;
+
+static inline bool is_slot_ref(ListRef r) { return (r & 1) != 0; }
+
+// Intrusive, non-atomic owning ListRef. The interpreter is single-threaded
+// per Env, so plain counters are enough.
+class ListPtr {
+    ListRef r;
+public:
+    ListPtr() : r(0) {}
+    ListPtr(nullptr_t) : r(0) {}
+    explicit ListPtr(ListRef raw); // takes a new reference
+    ListPtr(const ListPtr &o);
+    ListPtr(ListPtr &&o) noexcept : r(o.r) { o.r = 0; }
+    ~ListPtr();
+    ListPtr &operator=(const ListPtr &o) { ListPtr t(o); swap(r, t.r); return *this; }
+    ListPtr &operator=(ListPtr &&o) noexcept { swap(r, o.r); return *this; }
+
+    ListRef raw() const { return r; }
+    explicit operator bool() const { return r != 0; }
+    bool operator==(nullptr_t) const { return r == 0; }
+    bool operator!=(nullptr_t) const { return r != 0; }
+    // Give up the reference without decrementing; the caller owns it now
+    ListRef detach() { ListRef n = r; r = 0; return n; }
+};
 
-enum ValueType { VT_INT, VT_LIST };
+enum ValueType { VT_INT, VT_LIST, VT_BIG };
 
-struct Value {
+// Payload and tag of a Value. Trivially copyable, so Value can copy the
+// union as a whole whichever member is active.
+struct ValueBits {
+    union {
+        long long ival;
+        ListRef lref; // VT_LIST: owned reference, 0 is the empty list
+        BigInt *big;  // VT_BIG: owned reference, never null (--ints=big)
+    };
     ValueType type;
-    long long ival;
-    ListPtr list;
+};
 
-    Value() : type(VT_INT), ival(0), list(nullptr) {}
-    static Value make_int(long long v) { Value x; x.type = VT_INT; x.ival = v; return x; }
-    static Value make_list(ListPtr l) { Value x; x.type = VT_LIST; x.list = l; return x; }
+// 16-byte tagged value. Only list and big values touch a reference count;
+// copying or moving an int is a plain two-word copy.
+struct Value : ValueBits {
+    Value() { ival = 0; type = VT_INT; }
+    Value(const Value &o) : ValueBits(o) { if (type != VT_INT && lref) retain(); }
+    Value(Value &&o) noexcept : ValueBits(o) { o.ival = 0; o.type = VT_INT; }
+    PPL_INLINE ~Value() { if (type != VT_INT && lref) drop(); } // lref is 0 only for the empty list
+    Value &operator=(const Value &o) { Value t(o); swap(t); return *this; }
+    Value &operator=(Value &&o) noexcept { Value t(move(o)); swap(t); return *this; }
+    void swap(Value &o) noexcept { std::swap(static_cast<ValueBits&>(*this), static_cast<ValueBits&>(o)); }
+
+    static Value make_int(long long v) { Value x; x.ival = v; return x; }
+    static Value make_list(ListPtr l) { Value x; x.type = VT_LIST; x.lref = l.detach(); return x; }
+    static Value make_big(BigInt *b) { Value x; x.type = VT_BIG; x.big = b; return x; } // takes b's reference
+    bool is_int() const { return type != VT_LIST; } // a long long or a big
+    // Give up a list reference without decrementing (0 for ints); the caller owns it now
+    ListRef detach_list() {
+        if (type != VT_LIST) return 0;
+        ListRef n = lref;
+        ival = 0;
+        type = VT_INT;
+        return n;
+    }
     // Deep copy
     Value deep_copy() const;
+
+private:
+    void retain();
+    void drop();
 };
 
+// Lists only grow by prepending, so every cell can record the length of the
+// list it starts when it is made. Lengths are 32-bit to fit the padding.
 struct ListNode {
     Value v;
     ListPtr next;
-    ListNode(const Value &val, ListPtr nx = nullptr) : v(val), next(nx) {}
+    unsigned refs;
+    unsigned len; // elements from this cell on
+    ListNode(Value val, ListPtr nx, unsigned len_) : v(move(val)), next(move(nx)), refs(0), len(len_) {}
 };
+static_assert(sizeof(ListNode) == 32, "ListNode must stay 32 bytes");
 
-Value Value::deep_copy() const {
-    if (type == VT_INT) return Value::make_int(ival);
-    // deep copy list nodes
-    if (!list) return Value::make_list(nullptr);
-    // copy nodes recursively
-    // We'll copy node-by-node preserving order.
-    ListPtr head = nullptr;
-    ListPtr *pp = &head;
-    ListPtr curSrc = list;
-    while (curSrc) {
-        Value vcopy = curSrc->v.type == VT_INT ? Value::make_int(curSrc->v.ival)
-                                               : Value::make_list(curSrc->v.list ? curSrc->v.list->v.deep_copy().list : nullptr);
-        // But nested lists need deep copy; use recursion:
-        if (curSrc->v.type == VT_LIST) vcopy = curSrc->v.deep_copy();
-        *pp = make_shared<ListNode>(vcopy, nullptr);
-        pp = &((*pp)->next);
-        curSrc = curSrc->next;
-    }
-    return Value::make_list(head);
-}
-
-// Utility: print value
-string value_to_string(const Value &val);
-
-string list_to_string(ListPtr head) {
-    if (!head) return "[]";
-    string s = "[";
-    ListPtr cur = head;
-    bool first = true;
-    while (cur) {
-        if (!first) s += ", ";
-        s += value_to_string(cur->v);
-        first = false;
-        cur = cur->next;
-    }
-    s += "]";
-    return s;
-}
+// Unrolled run of ints. Prepending fills slots from the top down, so
+// vals[lo..SLOTS) are in use and a list may start at any of them; one count
+// covers every reference into the chunk. Chunks are CHUNK_BYTES-aligned so a
+// slot reference finds its chunk by masking.
+struct IntChunk {
+    static const size_t CHUNK_BYTES = 128;
+    static const int SLOTS = (int)((CHUNK_BYTES - 2 * sizeof(unsigned) - sizeof(ListPtr) - sizeof(long long)) / sizeof(long long));
+    unsigned refs;
+    unsigned lo;
+    ListPtr next;      // the list after vals[SLOTS - 1]
+    unsigned next_len; // its length
+    long long vals[SLOTS];
+    explicit IntChunk(int lo_) : refs(0), lo((unsigned)lo_), next_len(0) {}
+};
+static_assert(sizeof(IntChunk) == IntChunk::CHUNK_BYTES, "IntChunk must fill its cell exactly");
 
-string value_to_string(const Value &val) {
-    if (val.type == VT_INT) return to_string(val.ival);
-    return list_to_string(val.list);
+static inline IntChunk *chunk_of(ListRef r) { return reinterpret_cast<IntChunk*>(r & ~(uintptr_t)(IntChunk::CHUNK_BYTES - 1)); }
+static inline long long *slot_of(ListRef r) { return reinterpret_cast<long long*>(r - 1); }
+static inline ListRef slot_ref(long long *s) { return reinterpret_cast<uintptr_t>(s) + 1; }
+static inline ListNode *node_of(ListRef r) { return reinterpret_cast<ListNode*>(r); }
+static inline unsigned &refs_of(ListRef r) { return is_slot_ref(r) ? chunk_of(r)->refs : node_of(r)->refs; }
+
+// The list after r's first element, borrowed
+static inline ListRef list_next(ListRef r) {
+    if (!is_slot_ref(r)) return node_of(r)->next.raw();
+    IntChunk *c = chunk_of(r);
+    return slot_of(r) + 1 < c->vals + IntChunk::SLOTS ? r + sizeof(long long) : c->next.raw();
 }
 
-// Environment: map from identifier -> Value + type info
-struct Env {
-    map<string, Value> table;
+// Number of elements in the list r starts, without walking it
+static inline size_t list_length(ListRef r) {
+    if (!r) return 0;
+    if (!is_slot_ref(r)) return node_of(r)->len;
+    const IntChunk *c = chunk_of(r);
+    return (size_t)(c->vals + IntChunk::SLOTS - slot_of(r)) + c->next_len;
+}
 
-    bool exists(const string &id) const { return table.find(id) != table.end(); }
-    Value &get(const string &id) {
-        auto it = table.find(id);
-        if (it == table.end()) throw runtime_error("Undefined identifier: " + id);
-        return it->second;
-    }
-    const Value &get_const(const string &id) const {
-        auto it = table.find(id);
-        if (it == table.end()) throw runtime_error("Undefined identifier: " + id);
-        return it->second;
-    }
-    void set(const string &id, const Value &v) { table[id] = v; }
+// A run stopped by --max-steps, --max-memory or --timeout. The engine that
+// catches it on the way out fills in where it stopped.
+struct LimitExceeded : runtime_error {
+    int line;        // program line being executed, 0 if not known yet
+    long long steps; // instructions executed so far
+    string snapshot; // where the stopped state was saved, if anywhere
+    bool suspended;  // stopped on request (SIGTERM/SIGINT), not by a limit
+    explicit LimitExceeded(const string &what) : runtime_error(what), line(0), steps(0), suspended(false) {}
 };
 
-// Base Instruction class (Command)
-struct Instruction {
-    int lineNo;
-    Instruction(int l=0): lineNo(l) {}
-    virtual ~Instruction() {}
-    // execute returns next instruction index (1-based line number). Return -1 for HLT/terminate.
-    virtual int execute(Env &env, int pc, vector<Instruction*> &program) = 0;
+// A list longer than a cell's length field can hold. Not a configured
+// limit: the engines report it as a runtime error on the current line.
+struct ListTooLong : runtime_error {
+    size_t length;
+    explicit ListTooLong(size_t n) : runtime_error("List too long: " + to_string(n)), length(n) {}
 };
 
-typedef vector<string> Tokens;
+static void list_too_long(size_t n) PPL_COLD;
+static void list_too_long(size_t n) { throw ListTooLong(n); }
 
-static Tokens tokenize(const string &line) {
-    Tokens t;
-    istringstream iss(line);
-    string w;
-    while (iss >> w) t.push_back(w);
-    return t;
+// A list length as cells store it
+static inline unsigned stored_len(size_t n) {
+    if (n > UINT_MAX) list_too_long(n);
+    return (unsigned)n;
 }
 
-static long long to_int_const(const string &s, bool &ok) {
-    // parse decimal integer
-    try {
-        size_t idx=0;
-        long long v = stoll(s, &idx, 10);
-        ok = (idx == s.size());
-        return v;
-    } catch (...) { ok = false; return 0; }
-}
+// An int past the range of long long (--ints=big): sign and magnitude in
+// 32-bit limbs, least significant first, with no leading zero limb. Bigs are
+// immutable and shared by count like list cells. A value that fits a long
+// long is never a BigInt, so a big is never 0. Each one is linked into the
+// arena of the run that made it, which frees whatever is left when the arena
+// drops its cells wholesale.
+struct BigInt {
+    unsigned refs;
+    bool neg;
+    vector<uint32_t> mag;
+    ListArena *owner;
+    BigInt *prev, *next;
+};
 
-// Helper to check identifier name validity (simple)
-static bool is_identifier(const string &s) {
-    if (s.empty()) return false;
-    if (!isalpha(s[0]) && s[0] != '_') return false;
-    for (char c: s) if (!isalnum(c) && c != '_') return false;
-    return true;
-}
+// Slab pool for list cells: 32-byte ListNodes and 128-byte IntChunks, each
+// kind carved from its own slabs. Slabs are SLAB_BYTES-aligned so a cell
+// finds its arena by masking its own address; freed cells go onto intrusive
+// free lists and every slab is returned in one go when the arena is destroyed.
+struct ListArena {
+    static const size_t SLAB_BYTES = 64 * 1024;
 
-// Concrete instructions
+    struct Slab {
+        ListArena *owner;
+        Slab *next;
+    };
+    struct FreeCell { FreeCell *next; };
 
-struct Instr_INTEGER : Instruction {
-    string id;
-    Instr_INTEGER(int l, const string &id_) : Instruction(l), id(id_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (env.exists(id)) throw runtime_error("Line " + to_string(lineNo) + ": Identifier already declared: " + id);
-        env.set(id, Value::make_int(0));
-        return pc + 1;
+    Slab *slabs;
+    FreeCell *free_nodes, *free_chunks;
+    char *bump, *bump_end;     // ListNode region
+    char *cbump, *cbump_end;   // IntChunk region
+    Slab *spare;               // slabs kept by reset(), reused before allocating
+    vector<ListRef> pending;   // nested lists waiting to be released
+    // statistics (cell counts: nodes and chunks)
+    size_t live, peak, total, nslabs;
+    size_t max_bytes; // --max-memory: slab footprint limit, 0 for none
+    // --lists=hashcons: every cons is looked up by (head value, next) first,
+    // so equal lists built anywhere in the arena are one chain and compare
+    // equal by ListRef. Open addressing with linear probing; entries keep
+    // their hash so probing and growing never touch the cells.
+    struct Interned { ListRef r; size_t hash; }; // r 0: free
+    bool hashcons;
+    vector<Interned> table;
+    size_t interned, shared; // live entries; conses answered from the table
+    BigInt *bigs;            // every live BigInt of this run
+
+    ListArena() : slabs(nullptr), free_nodes(nullptr), free_chunks(nullptr), bump(nullptr), bump_end(nullptr),
+                  cbump(nullptr), cbump_end(nullptr), spare(nullptr), live(0), peak(0), total(0), nslabs(0), max_bytes(0),
+                  hashcons(false), interned(0), shared(0), bigs(nullptr) {}
+    ~ListArena() {
+        while (slabs) { Slab *n = slabs->next; free(slabs); slabs = n; }
+        while (spare) { Slab *n = spare->next; free(spare); spare = n; }
+        free_bigs();
     }
-};
+    ListArena(const ListArena &) = delete;
+    ListArena &operator=(const ListArena &) = delete;
 
-struct Instr_LIST : Instruction {
-    string id;
-    Instr_LIST(int l, const string &id_) : Instruction(l), id(id_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (env.exists(id)) throw runtime_error("Line " + to_string(lineNo) + ": Identifier already declared: " + id);
-        env.set(id, Value::make_list(nullptr));
-        return pc + 1;
+    // Forget every cell at once and keep the slabs for reuse. The caller
+    // must already have dropped (detached) every reference into the arena.
+    void reset() {
+        while (slabs) { Slab *n = slabs->next; slabs->next = spare; spare = slabs; slabs = n; }
+        free_nodes = free_chunks = nullptr;
+        bump = bump_end = cbump = cbump_end = nullptr;
+        live = 0;
+        for (Interned &e : table) e.r = 0;
+        interned = 0;
+        free_bigs();
     }
-};
 
-struct Instr_MERGE : Instruction {
-    string from, tolist;
-    Instr_MERGE(int l, const string &a, const string &b) : Instruction(l), from(a), tolist(b) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(from)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined identifier: " + from);
-        if (!env.exists(tolist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list identifier: " + tolist);
-        Value vfrom = env.get_const(from).deep_copy(); // copy of value inserted
-        Value target = env.get_const(tolist);
-        if (target.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": MERGE target is not a list: " + tolist);
-        // prepend
-        ListPtr old = target.list;
-        ListPtr newhead = make_shared<ListNode>(vfrom, old);
-        env.set(tolist, Value::make_list(newhead));
-        return pc + 1;
+    // A big with one reference, for the caller
+    BigInt *new_big(bool neg, vector<uint32_t> &&mag) {
+        BigInt *b = new BigInt;
+        b->refs = 1;
+        b->neg = neg;
+        b->mag = move(mag);
+        b->owner = this;
+        b->prev = nullptr;
+        b->next = bigs;
+        if (bigs) bigs->prev = b;
+        bigs = b;
+        return b;
+    }
+    void free_big(BigInt *b) {
+        (b->prev ? b->prev->next : bigs) = b->next;
+        if (b->next) b->next->prev = b->prev;
+        delete b;
+    }
+    void free_bigs() {
+        while (bigs) { BigInt *n = bigs->next; delete bigs; bigs = n; }
     }
-};
 
-struct Instr_COPY : Instruction {
-    string src, dst;
-    Instr_COPY(int l, const string &a, const string &b) : Instruction(l), src(a), dst(b) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(src)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined source: " + src);
-        const Value &v = env.get_const(src);
-        if (v.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": COPY source is not a list: " + src);
-        Value copy = v.deep_copy();
-        env.set(dst, copy);
-        return pc + 1;
+    static ListArena &owner_of(uintptr_t addr) {
+        return *reinterpret_cast<Slab*>(addr & ~(uintptr_t)(SLAB_BYTES - 1))->owner;
     }
-};
+    static ListArena &owner_of(const void *p) { return owner_of(reinterpret_cast<uintptr_t>(p)); }
 
-struct Instr_HEAD : Instruction {
-    string listid, id;
-    Instr_HEAD(int l, const string &listid_, const string &id_) : Instruction(l), listid(listid_), id(id_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(listid)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + listid);
-        const Value &lv = env.get_const(listid);
-        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": HEAD target not a list: " + listid);
-        if (!lv.list) throw runtime_error("Line " + to_string(lineNo) + ": HEAD on empty list: " + listid);
-        Value headval = lv.list->v.deep_copy();
-        env.set(id, headval); // create or replace id
-        return pc + 1;
+    ListPtr make(Value v, ListPtr next) {
+        unsigned len = stored_len(list_length(next.raw()) + 1);
+        void *mem = alloc(free_nodes, bump, bump_end, sizeof(ListNode), node_header());
+        return ListPtr(reinterpret_cast<ListRef>(new (mem) ListNode(move(v), move(next), len)));
     }
-};
 
-struct Instr_TAIL : Instruction {
-    string src, dst;
-    Instr_TAIL(int l, const string &a, const string &b) : Instruction(l), src(a), dst(b) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(src)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + src);
-        const Value &sv = env.get_const(src);
-        if (sv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": TAIL source not a list: " + src);
-        ListPtr head = sv.list;
-        if (!head) {
-            env.set(dst, Value::make_list(nullptr)); // empty list
-            return pc + 1;
-        }
-        // copy nodes from head->next onward
-        ListPtr cur = head->next;
-        ListPtr newHead = nullptr;
-        ListPtr *pp = &newHead;
-        while (cur) {
-            // deep copy element value
-            Value vcopy = cur->v.deep_copy();
-            *pp = make_shared<ListNode>(vcopy, nullptr);
-            pp = &((*pp)->next);
-            cur = cur->next;
+    // Empty chunk whose first used slot will be lo
+    IntChunk *new_chunk(int lo) {
+        return new (alloc(free_chunks, cbump, cbump_end, IntChunk::CHUNK_BYTES, IntChunk::CHUNK_BYTES)) IntChunk(lo);
+    }
+
+    // Prepend v to next (MERGE). An int takes the free slot just below next's
+    // head when that head is the lowest used slot of its chunk, and starts a
+    // new chunk when next is empty or starts with an int; anything else is
+    // boxed. With hashcons an existing cell for the same pair is reused.
+    ListPtr cons(Value v, ListPtr next) {
+        if (!hashcons) return new_cell(move(v), move(next));
+        size_t h = cell_hash(v.type, value_bits(v), next.raw());
+        ListRef hit = find_cell(h, v.type, value_bits(v), next.raw());
+        if (hit) {
+            ++shared;
+            return ListPtr(hit);
         }
-        env.set(dst, Value::make_list(newHead));
-        return pc + 1;
+        ListPtr cell = new_cell(move(v), move(next));
+        insert(cell.raw(), h);
+        return cell;
     }
-};
 
-struct Instr_ASSIGN : Instruction {
-    string id;
-    long long val;
-    Instr_ASSIGN(int l, const string &id_, long long v_) : Instruction(l), id(id_), val(v_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (env.exists(id)) {
-            Value &existing = env.get(id);
-            if (existing.type != VT_INT) throw runtime_error("Line " + to_string(lineNo) + ": ASSIGN to non-int: " + id);
-            existing.ival = val;
+    // Add a cell built elsewhere (a snapshot) to the table, unless an equal
+    // cell is already there
+    void intern(ListRef r) {
+        int type;
+        uint64_t bits;
+        ListRef next;
+        cell_key(r, type, bits, next);
+        size_t h = cell_hash(type, bits, next);
+        if (!find_cell(h, type, bits, next)) insert(r, h);
+    }
+
+    // Free a cell whose count reached zero, plus everything that only it kept
+    // alive. The next chain is unlinked in a loop and nested lists go through
+    // an explicit stack, so dropping a long or deep list uses constant C stack.
+    void release(ListRef r) {
+        ListRef cur = r;
+        for (;;) {
+            while (cur) {
+                ListRef next;
+                if (is_slot_ref(cur)) {
+                    IntChunk *c = chunk_of(cur);
+                    ListArena &a = owner_of(c);
+                    if (a.hashcons)
+                        for (int i = (int)c->lo; i < IntChunk::SLOTS; ++i) a.unintern(slot_ref(&c->vals[i]));
+                    next = c->next.detach();
+                    a.reclaim_chunk(c);
+                } else {
+                    ListNode *n = node_of(cur);
+                    ListArena &a = owner_of(n);
+                    if (a.hashcons) a.unintern(cur);
+                    next = n->next.detach();
+                    ListRef sub = n->v.detach_list();
+                    if (sub && --refs_of(sub) == 0) pending.push_back(sub);
+                    a.reclaim_node(n);
+                }
+                cur = (next && --refs_of(next) == 0) ? next : 0;
+            }
+            if (pending.empty()) break;
+            cur = pending.back();
+            pending.pop_back();
+        }
+    }
+
+    // MERGE into the list held by a variable. An int that fits the slot below
+    // the head is written there and the variable's reference moves down onto
+    // it; the chunk's count already covers it, so nothing else is touched.
+    void push_front(Value &list, Value v) {
+        if (v.type == VT_INT && !hashcons)
+            if (long long *s = free_slot_below(list.lref)) {
+                *s = v.ival;
+                --chunk_of(list.lref)->lo;
+                list.lref = slot_ref(s);
+                return;
+            }
+        list = Value::make_list(cons(move(v), ListPtr(list.lref)));
+    }
+
+    // The list at(0), ..., at(n-1) followed by tail: what MERGEs of at(n-1)
+    // down to at(0) would build, but each chunk is filled in one go
+    template <class At>
+    ListPtr prepend_ints(size_t n, At at, ListPtr tail) {
+        if (!n) return tail;
+        if (hashcons) {
+            while (n--) tail = cons(Value::make_int(at(n)), move(tail));
+            return tail;
+        }
+        --n;
+        ListPtr cur = new_cell(Value::make_int(at(n)), move(tail));
+        while (n) {
+            ListRef r = cur.raw();
+            IntChunk *c;
+            size_t k;
+            if (free_slot_below(r)) {
+                c = chunk_of(r);
+                k = min(n, (size_t)c->lo);
+                c->lo -= (unsigned)k;
+            } else {
+                k = min(n, (size_t)IntChunk::SLOTS);
+                unsigned len = stored_len(list_length(r));
+                c = new_chunk(IntChunk::SLOTS - (int)k);
+                c->next = move(cur);
+                c->next_len = len;
+            }
+            long long *d = c->vals + c->lo;
+            n -= k;
+            for (size_t i = 0; i < k; ++i) d[i] = at(n + i);
+            cur = ListPtr(slot_ref(d));
+        }
+        return cur;
+    }
+
+    size_t bytes() const { return nslabs * SLAB_BYTES; }
+
+private:
+    // The free slot just below r when r is the lowest used slot of its chunk
+    static long long *free_slot_below(ListRef r) {
+        if (!is_slot_ref(r)) return nullptr;
+        IntChunk *c = chunk_of(r);
+        long long *s = slot_of(r);
+        return c->lo > 0 && s == c->vals + c->lo ? s - 1 : nullptr;
+    }
+
+    ListPtr new_cell(Value v, ListPtr next) {
+        if (v.type == VT_INT) {
+            ListRef r = next.raw();
+            if (long long *s = free_slot_below(r)) {
+                *s = v.ival;
+                --chunk_of(r)->lo;
+                return ListPtr(slot_ref(s));
+            }
+            if (!r || is_slot_ref(r) || node_of(r)->v.type == VT_INT) {
+                unsigned len = stored_len(list_length(r));
+                IntChunk *c = new_chunk(IntChunk::SLOTS - 1);
+                c->vals[IntChunk::SLOTS - 1] = v.ival;
+                c->next = move(next);
+                c->next_len = len;
+                return ListPtr(slot_ref(&c->vals[IntChunk::SLOTS - 1]));
+            }
+        }
+        return make(move(v), move(next));
+    }
+
+    static uint64_t value_bits(const Value &v) { return v.type == VT_INT ? (uint64_t)v.ival : (uint64_t)v.lref; }
+
+    static size_t cell_hash(int type, uint64_t bits, ListRef next) {
+        // murmur3's finalizer: the low bits used for the index depend on every input bit
+        uint64_t h = (bits + (uint64_t)type) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)next;
+        h ^= h >> 33; h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ULL;
+        return (size_t)(h ^ (h >> 33));
+    }
+
+    static void cell_key(ListRef r, int &type, uint64_t &bits, ListRef &next) {
+        if (is_slot_ref(r)) {
+            type = VT_INT;
+            bits = (uint64_t)*slot_of(r);
         } else {
-            env.set(id, Value::make_int(val));
+            type = node_of(r)->v.type;
+            bits = value_bits(node_of(r)->v);
         }
-        return pc + 1;
+        next = list_next(r);
     }
-};
 
-struct Instr_CHS : Instruction {
-    string id;
-    Instr_CHS(int l, const string &id_) : Instruction(l), id(id_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(id)) throw runtime_error("Line " + to_string(lineNo) + ": CHS undefined id: " + id);
-        Value &v = env.get(id);
-        if (v.type != VT_INT) throw runtime_error("Line " + to_string(lineNo) + ": CHS on non-int: " + id);
-        v.ival = -v.ival;
-        return pc + 1;
+    static bool key_is(ListRef r, int type, uint64_t bits, ListRef next) {
+        int t;
+        uint64_t b;
+        ListRef n;
+        cell_key(r, t, b, n);
+        return t == type && b == bits && n == next;
     }
-};
 
-struct Instr_ADD : Instruction {
-    string a, b;
-    Instr_ADD(int l, const string &a_, const string &b_) : Instruction(l), a(a_), b(b_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(a)) throw runtime_error("Line " + to_string(lineNo) + ": ADD undefined id: " + a);
-        if (!env.exists(b)) throw runtime_error("Line " + to_string(lineNo) + ": ADD undefined id: " + b);
-        Value &va = env.get(a);
-        Value &vb = env.get(b);
-        if (va.type != VT_INT || vb.type != VT_INT) throw runtime_error("Line " + to_string(lineNo) + ": ADD type error");
-        va.ival += vb.ival;
-        return pc + 1;
+    ListRef find_cell(size_t h, int type, uint64_t bits, ListRef next) const {
+        if (table.empty()) return 0;
+        size_t mask = table.size() - 1;
+        for (size_t i = h & mask; table[i].r; i = (i + 1) & mask)
+            if (table[i].hash == h && key_is(table[i].r, type, bits, next)) return table[i].r;
+        return 0;
     }
-};
 
-struct Instr_IF : Instruction {
-    string id;
-    int target;
-    Instr_IF(int l, const string &id_, int target_) : Instruction(l), id(id_), target(target_) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        if (!env.exists(id)) throw runtime_error("Line " + to_string(lineNo) + ": IF undefined id: " + id);
-        const Value &v = env.get_const(id);
-        bool cond = false;
-        if (v.type == VT_INT) cond = (v.ival == 0);
-        else cond = (v.list == nullptr);
-        if (cond) {
-            if (target < 1 || target > (int)program.size()) throw runtime_error("Line " + to_string(lineNo) + ": IF jump out of range: " + to_string(target));
-            return target; // line numbers are 1-based
-        } else return pc + 1;
+    // At most 3/4 full
+    void insert(ListRef r, size_t h) {
+        if ((interned + 1) * 4 > table.size() * 3) grow_table();
+        size_t mask = table.size() - 1, i = h & mask;
+        while (table[i].r) i = (i + 1) & mask;
+        table[i].r = r;
+        table[i].hash = h;
+        ++interned;
+    }
+
+    // Drop r's entry if r is the interned cell for its key; later entries of
+    // the probe run shift back so lookups never need tombstones
+    void unintern(ListRef r) {
+        if (table.empty()) return;
+        int type;
+        uint64_t bits;
+        ListRef next;
+        cell_key(r, type, bits, next);
+        size_t mask = table.size() - 1, i = cell_hash(type, bits, next) & mask;
+        while (table[i].r && table[i].r != r) i = (i + 1) & mask;
+        if (!table[i].r) return;
+        --interned;
+        for (size_t j = (i + 1) & mask; table[j].r; j = (j + 1) & mask) {
+            // move entry j into the hole unless its home lies in (i, j]
+            if (((j - table[j].hash) & mask) >= ((j - i) & mask)) {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i].r = 0;
+    }
+
+    void grow_table() {
+        vector<Interned> old;
+        old.swap(table);
+        Interned none = {0, 0};
+        table.assign(old.empty() ? 1024 : old.size() * 2, none);
+        size_t mask = table.size() - 1;
+        for (const Interned &e : old) {
+            if (!e.r) continue;
+            size_t i = e.hash & mask;
+            while (table[i].r) i = (i + 1) & mask;
+            table[i] = e;
+        }
+    }
+
+    static size_t node_header() { return (sizeof(Slab) + alignof(ListNode) - 1) / alignof(ListNode) * alignof(ListNode); }
+
+    void reclaim_node(ListNode *n) {
+        n->~ListNode(); // members are already detached
+        push_free(free_nodes, n);
+    }
+    void reclaim_chunk(IntChunk *c) {
+        c->~IntChunk();
+        push_free(free_chunks, c);
+    }
+    void push_free(FreeCell *&list, void *cell) {
+        FreeCell *f = static_cast<FreeCell*>(cell);
+        f->next = list;
+        list = f;
+        --live;
+    }
+
+    void *alloc(FreeCell *&list, char *&b, char *&e, size_t cell, size_t hdr) {
+        void *mem;
+        if (list) {
+            mem = list;
+            list = list->next;
+        } else {
+            if (b == e) grow(b, e, cell, hdr);
+            mem = b;
+            b += cell;
+        }
+        ++total;
+        if (++live > peak) peak = live;
+        return mem;
+    }
+
+    void grow(char *&b, char *&e, size_t cell, size_t hdr) {
+        void *mem = spare;
+        if (spare) {
+            spare = spare->next;
+        } else {
+            if (max_bytes && (nslabs + 1) * SLAB_BYTES > max_bytes)
+                throw LimitExceeded("max-memory " + to_string(max_bytes) + " bytes");
+            if (posix_memalign(&mem, SLAB_BYTES, SLAB_BYTES) != 0) throw bad_alloc();
+            ++nslabs;
+        }
+        Slab *s = static_cast<Slab*>(mem);
+        s->owner = this;
+        s->next = slabs;
+        slabs = s;
+        b = static_cast<char*>(mem) + hdr;
+        e = b + (SLAB_BYTES - hdr) / cell * cell;
     }
 };
 
-struct Instr_HLT : Instruction {
-    Instr_HLT(int l) : Instruction(l) {}
-    int execute(Env &env, int pc, vector<Instruction*> &program) override {
-        return -1; // terminate
+inline ListPtr::ListPtr(ListRef raw) : r(raw) { if (r) ++refs_of(r); }
+inline ListPtr::ListPtr(const ListPtr &o) : r(o.r) { if (r) ++refs_of(r); }
+inline ListPtr::~ListPtr() {
+    if (r && --refs_of(r) == 0) ListArena::owner_of(r).release(r);
+}
+inline void Value::retain() {
+    if (type == VT_BIG) ++big->refs;
+    else ++refs_of(lref);
+}
+inline void Value::drop() {
+    if (type == VT_BIG) { if (--big->refs == 0) big->owner->free_big(big); }
+    else if (--refs_of(lref) == 0) ListArena::owner_of(lref).release(lref);
+}
+
+// Copy the list starting at src, including nested lists, into src's arena.
+// Works from an explicit stack of (source list, destination value) pairs so
+// the C stack stays flat however deep the nesting goes; int runs are copied
+// a chunk at a time. New cells are not visible to anyone yet, so filling
+// them in place is safe; each takes the length of the cell it copies.
+static ListPtr copy_chain(ListRef src) {
+    if (!src) return nullptr;
+    ListArena &arena = ListArena::owner_of(src);
+    ListPtr head;
+    vector<pair<ListRef, Value*> > work; // destination nullptr: the result
+    work.push_back(make_pair(src, (Value*)nullptr));
+    while (!work.empty()) {
+        ListRef cur = work.back().first;
+        Value *dst = work.back().second;
+        work.pop_back();
+        ListPtr chain;
+        ListPtr *pp = &chain;
+        while (cur) {
+            if (is_slot_ref(cur)) {
+                IntChunk *c = chunk_of(cur);
+                long long *s = slot_of(cur);
+                int lo = (int)(s - c->vals);
+                IntChunk *n = arena.new_chunk(lo);
+                memcpy(n->vals + lo, s, (IntChunk::SLOTS - lo) * sizeof(long long));
+                n->next_len = c->next_len;
+                *pp = ListPtr(slot_ref(n->vals + lo));
+                pp = &n->next;
+                cur = c->next.raw();
+            } else {
+                const ListNode *nd = node_of(cur);
+                Value elem = nd->v.is_int() ? nd->v : Value::make_list(nullptr);
+                *pp = arena.make(move(elem), nullptr);
+                ListNode *n = node_of(pp->raw());
+                n->len = nd->len;
+                if (nd->v.type == VT_LIST && nd->v.lref) work.push_back(make_pair(nd->v.lref, &n->v));
+                pp = &n->next;
+                cur = nd->next.raw();
+            }
+        }
+        if (dst) *dst = Value::make_list(move(chain));
+        else head = move(chain);
+    }
+    return head;
+}
+
+Value Value::deep_copy() const {
+    if (type != VT_LIST) return *this; // bigs are immutable
+    return Value::make_list(copy_chain(lref));
+}
+
+// First element of a non-empty list
+inline Value list_first(ListRef r) {
+    return is_slot_ref(r) ? Value::make_int(*slot_of(r)) : node_of(r)->v;
+}
+
+// List cells are never mutated after creation (a chunk only gains slots
+// below every existing reference), so in persistent mode COPY, HEAD, TAIL
+// and MERGE can share existing chains instead of rebuilding them.
+inline Value value_copy(const Value &v, bool persistent) {
+    return persistent ? v : v.deep_copy();
+}
+inline Value value_copy(Value &&v, bool persistent) {
+    return persistent ? move(v) : v.deep_copy();
+}
+
+inline ListPtr list_tail(ListRef head, bool persistent) {
+    if (!head) return nullptr;
+    if (!persistent) return copy_chain(list_next(head)); // deep copy of every element after the head
+    return ListPtr(list_next(head));
+}
+
+// TAIL L L: replace L's list by its tail. Inside a chunk the reference just
+// moves up a slot, and a list that is the chunk's only reference hands its
+// head slot back for the next MERGE. Without persistent lists the tail is
+// only copied when something else still holds the old head; otherwise no one
+// can see that the cells are reused.
+inline void list_drop_front(Value &list, bool persistent) {
+    ListRef r = list.lref;
+    if (!r) return;
+    bool unique = refs_of(r) == 1;
+    if (is_slot_ref(r) && (persistent || unique)) {
+        IntChunk *c = chunk_of(r);
+        long long *s = slot_of(r);
+        if (s + 1 < c->vals + IntChunk::SLOTS) {
+            if (unique && s == c->vals + c->lo && !ListArena::owner_of(c).hashcons) ++c->lo;
+            list.lref = slot_ref(s + 1);
+            return;
+        }
+    }
+    if (persistent || unique) list = Value::make_list(ListPtr(list_next(r)));
+    else list = Value::make_list(copy_chain(list_next(r)));
+}
+
+// Int arithmetic. By default ADD, SUB and CHS wrap like two's-complement
+// int64. With --ints=big a result that overflows becomes a BigInt, and an
+// operation with a big operand is done exactly. The long long case stays
+// inline and only the overflow branch leaves it.
+static inline bool add_overflows(long long a, long long b, long long &r) {
+#if defined(__GNUC__)
+    return __builtin_add_overflow(a, b, &r);
+#else
+    r = wrap_add(a, b);
+    return (a < 0) == (b < 0) && (r < 0) != (a < 0);
+#endif
+}
+static inline bool sub_overflows(long long a, long long b, long long &r) {
+#if defined(__GNUC__)
+    return __builtin_sub_overflow(a, b, &r);
+#else
+    r = wrap_sub(a, b);
+    return (a < 0) != (b < 0) && (r < 0) != (a < 0);
+#endif
+}
+
+// Sign and magnitude of an int value; a big's limbs are not copied
+struct BigView {
+    bool neg;
+    const uint32_t *p;
+    size_t n;
+    uint32_t small[2];
+    explicit BigView(const Value &v) {
+        if (v.type == VT_BIG) {
+            neg = v.big->neg; p = v.big->mag.data(); n = v.big->mag.size();
+            return;
+        }
+        neg = v.ival < 0;
+        unsigned long long m = neg ? 0 - (unsigned long long)v.ival : (unsigned long long)v.ival;
+        small[0] = (uint32_t)m;
+        small[1] = (uint32_t)(m >> 32);
+        p = small;
+        n = small[1] ? 2 : small[0] ? 1 : 0;
     }
+    BigView(const BigView &) = delete;
 };
 
-// Parser: create an Instruction for each line
-Instruction* parse_line(const string &line, int lineno) {
-    Tokens t = tokenize(line);
-    if (t.empty()) return nullptr; // allow blank lines (ignored)
-    string op = t[0];
-    if (op == "INTEGER") {
-        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": INTEGER requires exactly one argument");
-        if (!is_identifier(t[1])) throw runtime_error("Line " + to_string(lineno) + ": invalid identifier: " + t[1]);
-        return new Instr_INTEGER(lineno, t[1]);
-    } else if (op == "LIST") {
-        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": LIST requires exactly one argument");
-        if (!is_identifier(t[1])) throw runtime_error("Line " + to_string(lineno) + ": invalid identifier: " + t[1]);
-        return new Instr_LIST(lineno, t[1]);
-    } else if (op == "MERGE") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": MERGE requires two arguments");
-        return new Instr_MERGE(lineno, t[1], t[2]);
-    } else if (op == "COPY") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": COPY requires two arguments");
-        return new Instr_COPY(lineno, t[1], t[2]);
-    } else if (op == "HEAD") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": HEAD requires two arguments");
-        return new Instr_HEAD(lineno, t[1], t[2]);
-    } else if (op == "TAIL") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": TAIL requires two arguments");
-        return new Instr_TAIL(lineno, t[1], t[2]);
-    } else if (op == "ASSIGN") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": ASSIGN requires two arguments");
-        bool ok=false; long long v = to_int_const(t[2], ok);
-        if (!ok) throw runtime_error("Line " + to_string(lineno) + ": ASSIGN needs integer constant, got: " + t[2]);
-        return new Instr_ASSIGN(lineno, t[1], v);
-    } else if (op == "CHS") {
-        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": CHS requires one argument");
-        return new Instr_CHS(lineno, t[1]);
-    } else if (op == "ADD") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": ADD requires two arguments");
-        return new Instr_ADD(lineno, t[1], t[2]);
-    } else if (op == "IF") {
-        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": IF requires two arguments");
-        bool ok=false; int target = (int)to_int_const(t[2], ok);
-        if (!ok || target <= 0) throw runtime_error("Line " + to_string(lineno) + ": IF target must be positive integer");
-        return new Instr_IF(lineno, t[1], target);
-    } else if (op == "HLT") {
-        if (t.size() != 1) throw runtime_error("Line " + to_string(lineno) + ": HLT takes no arguments");
-        return new Instr_HLT(lineno);
+static int compare_mag(const BigView &a, const BigView &b) {
+    if (a.n != b.n) return a.n < b.n ? -1 : 1;
+    for (size_t i = a.n; i--; )
+        if (a.p[i] != b.p[i]) return a.p[i] < b.p[i] ? -1 : 1;
+    return 0;
+}
+
+// The int value with this sign and magnitude: a long long whenever it fits
+static Value int_value(ListArena &arena, bool neg, vector<uint32_t> &mag) {
+    while (!mag.empty() && !mag.back()) mag.pop_back();
+    if (mag.size() <= 2) {
+        unsigned long long m = mag.empty() ? 0 : mag[0] | (mag.size() > 1 ? (unsigned long long)mag[1] << 32 : 0);
+        if (m <= (unsigned long long)LLONG_MAX || (neg && m == (unsigned long long)LLONG_MAX + 1))
+            return Value::make_int(neg ? wrap_neg((long long)m) : (long long)m);
+    }
+    return Value::make_big(arena.new_big(neg, move(mag)));
+}
+
+// Exact a + b for int values
+static Value big_add(ListArena &arena, const Value &a, const Value &b) {
+    BigView x(a), y(b);
+    vector<uint32_t> mag;
+    bool neg;
+    if (x.neg == y.neg) {
+        const BigView &l = x.n >= y.n ? x : y, &s = x.n >= y.n ? y : x;
+        neg = x.neg;
+        mag.resize(l.n + 1);
+        unsigned long long carry = 0;
+        for (size_t i = 0; i < l.n; ++i) {
+            carry += (unsigned long long)l.p[i] + (i < s.n ? s.p[i] : 0);
+            mag[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        mag[l.n] = (uint32_t)carry;
     } else {
-        throw runtime_error("Line " + to_string(lineno) + ": Unknown operation: " + op);
+        int c = compare_mag(x, y);
+        if (c == 0) return Value::make_int(0);
+        const BigView &l = c > 0 ? x : y, &s = c > 0 ? y : x;
+        neg = l.neg;
+        mag.resize(l.n);
+        long long borrow = 0;
+        for (size_t i = 0; i < l.n; ++i) {
+            long long d = (long long)l.p[i] - (i < s.n ? s.p[i] : 0) - borrow;
+            borrow = d < 0;
+            mag[i] = (uint32_t)(d + (borrow << 32));
+        }
     }
+    return int_value(arena, neg, mag);
 }
 
-// Read program file -> vector<Instruction*>
-vector<Instruction*> load_program(const string &filename) {
-    ifstream in(filename.c_str());
-    if (!in) throw runtime_error("Unable to open file: " + filename);
-    vector<Instruction*> prog;
-    string line;
-    int lineno = 0;
-    while (std::getline(in, line)) {
-        ++lineno;
-        // Trim trailing/leading whitespace
-        size_t start = line.find_first_not_of(" \t\r\n");
-        if (start == string::npos) { prog.push_back(nullptr); continue; } // blank line allowed
-        size_t end = line.find_last_not_of(" \t\r\n");
-        string trimmed = line.substr(start, end - start + 1);
-        //We parse a line to create a specific instruction.
-        Instruction *ins = parse_line(trimmed, lineno);
-        prog.push_back(ins); // may be nullptr if blank line
+// Exact -a for an int value
+static Value big_neg(ListArena &arena, const Value &a) {
+    BigView x(a);
+    vector<uint32_t> mag(x.p, x.p + x.n);
+    return int_value(arena, !x.neg && x.n, mag);
+}
+
+static string big_to_string(const BigInt &b) {
+    vector<uint32_t> q(b.mag);
+    string digits; // least significant first
+    while (!q.empty()) {
+        unsigned long long rem = 0;
+        for (size_t i = q.size(); i--; ) {
+            unsigned long long cur = rem << 32 | q[i];
+            q[i] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        while (!q.empty() && !q.back()) q.pop_back();
+        for (int k = 0; k < 9 && (rem || !q.empty()); ++k) {
+            digits += (char)('0' + rem % 10);
+            rem /= 10;
+        }
     }
-    // Replace nullptr blank lines with NOPs (we'll map them to a no-op instruction)
-    // For simplicity, convert nullptr to HLT? No: better convert to a no-op object.
-    for (size_t i = 0; i < prog.size(); ++i) {
-        if (!prog[i]) {
-            // create a tiny instruction that does nothing
-            struct NOP : Instruction { NOP(int l): Instruction(l){} int execute(Env&, int pc, vector<Instruction*>&){ return pc+1; } };
-            prog[i] = new NOP((int)i+1);
+    if (b.neg) digits += '-';
+    return string(digits.rbegin(), digits.rend());
+}
+
+static void int_add_slow(ListArena &arena, Value &a, const Value &b) PPL_SLOW;
+static void int_add_slow(ListArena &arena, Value &a, const Value &b) { a = big_add(arena, a, b); }
+static void int_sub_slow(ListArena &arena, Value &a, const Value &b) PPL_SLOW;
+static void int_sub_slow(ListArena &arena, Value &a, const Value &b) { a = big_add(arena, a, big_neg(arena, b)); }
+static void int_neg_slow(ListArena &arena, Value &a) PPL_SLOW;
+static void int_neg_slow(ListArena &arena, Value &a) { a = big_neg(arena, a); }
+
+// ADD a b, SUB a b and CHS a on int values (the type checks come first).
+// Without big there are no BigInts and the result wraps.
+PPL_INLINE void int_add(Value &a, const Value &b, bool big, ListArena &arena) {
+    long long r;
+    if (!big) a.ival = wrap_add(a.ival, b.ival);
+    else if (a.type == VT_INT && b.type == VT_INT && !add_overflows(a.ival, b.ival, r)) a.ival = r;
+    else int_add_slow(arena, a, b);
+}
+PPL_INLINE void int_sub(Value &a, const Value &b, bool big, ListArena &arena) {
+    long long r;
+    if (!big) a.ival = wrap_sub(a.ival, b.ival);
+    else if (a.type == VT_INT && b.type == VT_INT && !sub_overflows(a.ival, b.ival, r)) a.ival = r;
+    else int_sub_slow(arena, a, b);
+}
+PPL_INLINE void int_neg(Value &a, bool big, ListArena &arena) {
+    if (!big || (a.type == VT_INT && a.ival != LLONG_MIN)) a.ival = wrap_neg(a.ival);
+    else int_neg_slow(arena, a);
+}
+
+// Bulk list instructions. They walk a list a cell at a time, taking each int
+// chunk as one run of slots, and build their results with prepend_ints.
+
+// SUM: wraps like ADD, or is exact with big. False if some element is a list.
+static bool list_sum(ListRef r, Value &sum, bool big, ListArena &arena) {
+    if (!big) {
+        unsigned long long acc = 0;
+        while (r) {
+            if (is_slot_ref(r)) {
+                const IntChunk *c = chunk_of(r);
+                for (const long long *p = slot_of(r), *e = c->vals + IntChunk::SLOTS; p < e; ++p) acc += (unsigned long long)*p;
+                r = c->next.raw();
+            } else {
+                const ListNode *n = node_of(r);
+                if (n->v.type != VT_INT) return false;
+                acc += (unsigned long long)n->v.ival;
+                r = n->next.raw();
+            }
         }
+        sum = Value::make_int((long long)acc);
+        return true;
     }
-    return prog;
+    // a long long running total; rest holds whatever overflowed it
+    long long acc = 0, t;
+    Value rest = Value::make_int(0);
+    auto add = [&](long long x) {
+        if (!add_overflows(acc, x, t)) { acc = t; return; }
+        rest = big_add(arena, rest, Value::make_int(acc));
+        acc = x;
+    };
+    while (r) {
+        if (is_slot_ref(r)) {
+            const IntChunk *c = chunk_of(r);
+            for (const long long *p = slot_of(r), *e = c->vals + IntChunk::SLOTS; p < e; ++p) add(*p);
+            r = c->next.raw();
+        } else {
+            const ListNode *n = node_of(r);
+            if (n->v.type == VT_INT) add(n->v.ival);
+            else if (n->v.type == VT_BIG) rest = big_add(arena, rest, n->v);
+            else return false;
+            r = n->next.raw();
+        }
+    }
+    sum = big_add(arena, rest, Value::make_int(acc));
+    return true;
 }
 
-void free_program(vector<Instruction*> &prog) {
-    for (Instruction* p : prog) delete p;
-    prog.clear();
+// RANGE: 0, 1, ..., n-1
+static ListPtr list_range(ListArena &arena, size_t n) {
+    stored_len(n);
+    return arena.prepend_ints(n, [](size_t i) { return (long long)i; }, nullptr);
 }
 
-// Execute program
-void run_program(vector<Instruction*> &prog, Env &env) {
-    int pc = 1; // 1-based
-    int lines = (int)prog.size();
-    while (pc >= 1) {
-        if (pc > lines) break; // fall off end => terminate
-        Instruction* ins = prog[pc-1];
-        try {
-            int next = ins->execute(env, pc, prog);
-            if (next == -1) break; // HLT
-            pc = next;
-        } catch (const runtime_error &e) {
-            cerr << "Runtime error: " << e.what() << endl;
-            return;
+// FILL: n copies of v
+static ListPtr list_fill(ListArena &arena, const Value &v, size_t n, bool persistent) {
+    if (v.type == VT_INT) {
+        long long x = v.ival;
+        return arena.prepend_ints(n, [x](size_t) { return x; }, nullptr);
+    }
+    ListPtr out;
+    while (n--) out = arena.cons(value_copy(v, persistent), move(out));
+    return out;
+}
+
+// REVERSE: the elements of r, last first
+static ListPtr list_reverse(ListArena &arena, ListRef r, bool persistent) {
+    ListPtr tail;
+    while (r) {
+        if (is_slot_ref(r)) {
+            const IntChunk *c = chunk_of(r);
+            const long long *p = slot_of(r);
+            size_t k = (size_t)(c->vals + IntChunk::SLOTS - p);
+            tail = arena.prepend_ints(k, [p, k](size_t i) { return p[k - 1 - i]; }, move(tail));
+            r = c->next.raw();
+        } else {
+            const ListNode *n = node_of(r);
+            tail = arena.cons(value_copy(n->v, persistent), move(tail));
+            r = n->next.raw();
         }
     }
-    // Print all identifiers sorted
-    vector<string> names;
-    for (auto &p : env.table) names.push_back(p.first);
-    sort(names.begin(), names.end());
-    for (auto &n : names) {
-        cout << n << " = ";
-        const Value &v = env.get_const(n);
-        if (v.type == VT_INT) cout << v.ival << "\n";
-        else cout << list_to_string(v.list) << "\n";
+    return tail;
+}
+
+// CONCAT: the elements of r, in order, prepended to tail. The cells of r are
+// visited again from the last, so each run goes on in one piece.
+static ListPtr list_concat(ListArena &arena, ListRef r, ListPtr tail, bool persistent) {
+    stored_len(list_length(r) + list_length(tail.raw()));
+    vector<ListRef> cells;
+    for (; r; r = is_slot_ref(r) ? chunk_of(r)->next.raw() : node_of(r)->next.raw()) cells.push_back(r);
+    for (size_t i = cells.size(); i--; ) {
+        ListRef c = cells[i];
+        if (is_slot_ref(c)) {
+            const long long *p = slot_of(c);
+            size_t k = (size_t)(chunk_of(c)->vals + IntChunk::SLOTS - p);
+            tail = arena.prepend_ints(k, [p](size_t j) { return p[j]; }, move(tail));
+        } else {
+            tail = arena.cons(value_copy(node_of(c)->v, persistent), move(tail));
+        }
     }
+    return tail;
 }
 
-// CLI
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        cerr << "Usage: ppl <program-file>\n";
-        return 1;
+// Buffered output sink: values are formatted straight into a fixed buffer
+// that goes to the stream (or string) in large chunks, with no per-value strings.
+class OutBuf {
+    ostream *os;
+    string *str;
+    size_t n;
+    char buf[1 << 16];
+    void emit(const char *p, size_t len) { if (str) str->append(p, len); else os->write(p, (streamsize)len); }
+public:
+    explicit OutBuf(ostream &o) : os(&o), str(nullptr), n(0) {}
+    explicit OutBuf(string &s) : os(nullptr), str(&s), n(0) {}
+    ~OutBuf() { flush(); }
+    OutBuf(const OutBuf &) = delete;
+    OutBuf &operator=(const OutBuf &) = delete;
+
+    void flush() { if (n) { emit(buf, n); n = 0; } }
+    void put(char c) { if (n == sizeof buf) flush(); buf[n++] = c; }
+    void write(const char *p, size_t len) {
+        if (len > sizeof buf - n) {
+            flush();
+            if (len > sizeof buf) { emit(p, len); return; }
+        }
+        memcpy(buf + n, p, len);
+        n += len;
     }
-    string fname = argv[1];
-    vector<Instruction*> prog;
-    try {
-        //Loads PPL instructions into prog Instruction* vector.
-        prog = load_program(fname);
-    } catch (const exception &e) {
-        cerr << "Error loading program: " << e.what() << endl;
-        return 1;
+    void write(const string &s) { write(s.data(), s.size()); }
+    void put_int(long long v) {
+        char tmp[20], *end = tmp + sizeof tmp, *p = end;
+        unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        do { *--p = (char)('0' + u % 10); u /= 10; } while (u);
+        if (v < 0) *--p = '-';
+        write(p, (size_t)(end - p));
     }
-    Env env;
-    //Runs program using a default environment and the loaded instructions.
-    run_program(prog, env);
-    //Clears the instructions (if re-use were to be desired)
-    free_program(prog);
-    return 0;
-}
\ No newline at end of file
+    // little-endian fixed-width integer for --output=binary
+    void put_le(unsigned long long v, int bytes) {
+        for (int i = 0; i < bytes; ++i) put((char)(v >> (8 * i)));
+    }
+};
+
+// --output=text (the classic dump), json, or binary:
+//   "PPLV" u32 version, u32 count, then per identifier u32 name length, name,
+//   value; a value is 'i' + int64 or '[' values... ']'. All little-endian.
+//   Version 2 (--ints=big) adds 'n' + u8 sign, u32 limb count, u32 limbs.
+enum OutputFormat { OUT_TEXT, OUT_JSON, OUT_BINARY };
+
+// Write one value. Nested lists are walked with an explicit stack of resume
+// points, so nesting depth costs heap, not C stack.
+void write_value(OutBuf &out, const Value &v, OutputFormat fmt) {
+    auto put_int = [&](long long x) {
+        if (fmt == OUT_BINARY) { out.put('i'); out.put_le((unsigned long long)x, 8); }
+        else out.put_int(x);
+    };
+    auto put_big = [&](const BigInt &b) {
+        if (fmt == OUT_BINARY) {
+            out.put('n');
+            out.put(b.neg);
+            out.put_le((unsigned)b.mag.size(), 4);
+            for (uint32_t limb : b.mag) out.put_le(limb, 4);
+        } else {
+            string d = big_to_string(b);
+            out.write(d.data(), d.size());
+        }
+    };
+    if (v.type == VT_INT) { put_int(v.ival); return; }
+    if (v.type == VT_BIG) { put_big(*v.big); return; }
+    const char open = '[', close = ']'; // the same bytes in every format
+    vector<ListRef> resume;
+    ListRef cur = v.lref;
+    bool first = true;
+    out.put(open);
+    for (;;) {
+        if (!cur) {
+            out.put(close);
+            if (resume.empty()) return;
+            cur = resume.back();
+            resume.pop_back();
+            first = false;
+            continue;
+        }
+        if (!first) {
+            if (fmt == OUT_TEXT) out.write(", ", 2);
+            else if (fmt == OUT_JSON) out.put(',');
+        }
+        first = false;
+        if (is_slot_ref(cur)) {
+            // a run of ints: write the rest of the chunk in one go
+            const IntChunk *c = chunk_of(cur);
+            const long long *s = slot_of(cur), *end = c->vals + IntChunk::SLOTS;
+            put_int(*s);
+            while (++s != end) {
+                if (fmt == OUT_TEXT) out.write(", ", 2);
+                else if (fmt == OUT_JSON) out.put(',');
+                put_int(*s);
+            }
+            cur = c->next.raw();
+            continue;
+        }
+        const ListNode *n = node_of(cur);
+        if (n->v.type != VT_LIST) {
+            if (n->v.type == VT_INT) put_int(n->v.ival);
+            else put_big(*n->v.big);
+            cur = n->next.raw();
+        } else {
+            resume.push_back(n->next.raw());
+            out.put(open);
+            cur = n->v.lref;
+            first = true;
+        }
+    }
+}
+
+string value_to_string(const Value &val) {
+    string s;
+    // at least "d, " per element; one reservation covers short flat lists
+    if (val.type == VT_LIST) s.reserve(list_length(val.lref) * 3 + 2);
+    {
+        OutBuf out(s);
+        write_value(out, val, OUT_TEXT);
+    }
+    return s;
+}
+
+string list_to_string(ListPtr head) { return value_to_string(Value::make_list(head)); }
+
+// Symbol table: identifier -> dense slot index. The loader interns each
+// identifier as it lexes it, so instructions never touch strings at run time.
+static unsigned long long fnv1a(const char *p, size_t n) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)p[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+struct SymbolTable {
+    vector<string> names;   // slot -> identifier
+    vector<int> buckets;    // open addressing on a hash of the name; slot + 1, 0 = empty
+
+    static unsigned long long hash(const char *p, size_t n) { return fnv1a(p, n); }
+
+    int find(const char *p, size_t n) const {
+        if (buckets.empty()) return -1;
+        size_t mask = buckets.size() - 1;
+        for (size_t i = hash(p, n) & mask;; i = (i + 1) & mask) {
+            int e = buckets[i];
+            if (!e) return -1;
+            const string &s = names[e - 1];
+            if (s.size() == n && memcmp(s.data(), p, n) == 0) return e - 1;
+        }
+    }
+    int find(const string &id) const { return find(id.data(), id.size()); }
+
+    int intern(const char *p, size_t n) {
+        int slot = find(p, n);
+        if (slot >= 0) return slot;
+        if ((names.size() + 1) * 2 > buckets.size()) rehash(buckets.empty() ? 64 : buckets.size() * 2);
+        slot = (int)names.size();
+        names.push_back(string(p, n));
+        place(slot);
+        return slot;
+    }
+    int intern(const string &id) { return intern(id.data(), id.size()); }
+    int size() const { return (int)names.size(); }
+
+    // Slots ordered by identifier, for the final dump
+    vector<int> sorted_slots() const {
+        vector<int> order(names.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = (int)i;
+        sort(order.begin(), order.end(), [this](int a, int b) { return names[a] < names[b]; });
+        return order;
+    }
+
+private:
+    void place(int slot) {
+        size_t mask = buckets.size() - 1;
+        size_t i = hash(names[slot].data(), names[slot].size()) & mask;
+        while (buckets[i]) i = (i + 1) & mask;
+        buckets[i] = slot + 1;
+    }
+    void rehash(size_t n) {
+        buckets.assign(n, 0);
+        for (size_t s = 0; s < names.size(); ++s) place((int)s);
+    }
+};
+
+// Resource limits for one run (0: unlimited)
+struct RunLimits {
+    long long max_steps = 0;  // --max-steps
+    size_t max_memory = 0;    // --max-memory, bytes of list arena
+    double timeout = 0;       // --timeout, seconds of wall time
+};
+
+struct SnapshotConfig;
+struct Trace;
+
+// A failed check in the bytecode engine. The engine only records what
+// failed and where, and returns; the message is built when it is reported.
+struct RunError {
+    long long line = 0;
+    const char *what = "";  // message text, the identifier or number follows
+    int slot = -1;          // identifier appended to what, -1 for none
+    long long number = 0;   // appended instead when slot is -1 and has_number
+    bool has_number = false;
+};
+
+// Environment: flat slot frame. A slot stays undefined until an instruction
+// declares or assigns it; the symbol table is only needed for printing.
+struct Env {
+    const SymbolTable *syms;
+    ListArena arena; // declared before frame: outlives every list in it
+    vector<Value> frame;
+    vector<char> defined;
+    bool persistent_lists; // share list structure instead of deep copying
+    bool big_ints;         // --ints=big: ADD, SUB and CHS overflow into BigInts
+    RunLimits limits;
+    int start_pc;                 // where the next run starts (--resume), as a 0-based code index
+    SnapshotConfig *snapshot;     // --snapshot settings, null for none
+    Trace *trace;                 // --trace ring, null for none
+    RunError error;               // why the last bytecode run failed
+
+    explicit Env(const SymbolTable &s) : syms(&s), frame(s.size()), defined(s.size(), 0), persistent_lists(true),
+                                         big_ints(false), start_pc(0), snapshot(nullptr), trace(nullptr) {}
+    // Every cell lives in this Env's arena, so teardown skips per-cell
+    // release and lets the arena drop its slabs wholesale.
+    ~Env() { for (Value &v : frame) v.detach_list(); }
+
+    // Back to the freshly constructed state without freeing arena memory
+    void reset() {
+        for (Value &v : frame) { v.detach_list(); v = Value(); }
+        fill(defined.begin(), defined.end(), 0);
+        arena.reset();
+        start_pc = 0;
+    }
+
+    // Make room for identifiers interned since construction (--serve)
+    void grow() {
+        frame.resize(syms->names.size());
+        defined.resize(syms->names.size(), 0);
+    }
+
+    bool exists(int slot) const { return defined[slot] != 0; }
+    Value &get(int slot) { return frame[slot]; }
+    const Value &get_const(int slot) const { return frame[slot]; }
+    void set(int slot, const Value &v) { frame[slot] = v; defined[slot] = 1; }
+    void set(int slot, Value &&v) { frame[slot] = move(v); defined[slot] = 1; }
+    const string &name(int slot) const { return syms->names[slot]; }
+
+    string error_message() const {
+        string msg = "Line " + to_string(error.line) + ": " + error.what;
+        if (error.slot >= 0) msg += name(error.slot);
+        else if (error.has_number) msg += to_string(error.number);
+        return msg;
+    }
+
+    void set_limits(const RunLimits &l) { limits = l; arena.max_bytes = l.max_memory; }
+};
+
+// Snapshots (--snapshot, --resume): the pc to continue at, the slot frame
+// and the list graph. Cells are written children first and each exactly
+// once, so shared structure is shared again after loading. Little-endian:
+//   "PPLS" u32 version, u32 engine, u64 program hash, u32 nslots, u32 pc
+//   cells, in id order:  'C' u8 lo, i64 vals[lo..SLOTS), ref next
+//                        'N' value, ref next
+//   'E', then per slot:  u8 defined, value if defined
+//   value: 'i' i64 | 'l' ref | 'b' u8 sign, u32 limb count, u32 limbs (--ints=big)
+//   ref:   u64, 0 for the empty list, else (cell id + 1) << 4 | slot (15: a node)
+static const uint32_t PPLS_VERSION = 3;
+enum SnapshotEngine { SNAP_CLASSIC = 1, SNAP_BYTECODE = 2 };
+
+// Set from SIGTERM/SIGINT when --snapshot is given: save and stop at the next back edge
+static volatile sig_atomic_t suspend_requested = 0;
+
+struct SnapshotConfig {
+    string path;
+    double every = 0;                 // seconds between background checkpoints, 0 for none
+    int engine = 0;                   // SnapshotEngine the pc belongs to
+    unsigned long long program = 0;   // program_hash of the code the pc indexes
+    chrono::steady_clock::time_point next_due;
+    pid_t writer = 0;                 // background checkpoint still being written
+
+    // Let an in-flight background checkpoint finish
+    void wait() {
+        if (writer > 0) waitpid(writer, nullptr, 0);
+        writer = 0;
+    }
+};
+
+static void write_snapshot(const Env &env, int pc, const SnapshotConfig &cfg) {
+    string tmp = cfg.path + ".tmp" + to_string((long)getpid());
+    ofstream f(tmp.c_str(), ios::binary | ios::trunc);
+    if (!f) throw runtime_error("Unable to write file: " + cfg.path);
+    {
+        OutBuf out(f);
+        out.write("PPLS", 4);
+        out.put_le(PPLS_VERSION, 4);
+        out.put_le((unsigned)cfg.engine, 4);
+        out.put_le(cfg.program, 8);
+        out.put_le((unsigned)env.frame.size(), 4);
+        out.put_le((unsigned)pc, 4);
+
+        unordered_map<uintptr_t, unsigned long long> ids; // cell address -> id
+        auto cell = [](ListRef r) { return is_slot_ref(r) ? reinterpret_cast<uintptr_t>(chunk_of(r)) : r; };
+        auto put_ref = [&](ListRef r) {
+            if (!r) { out.put_le(0, 8); return; }
+            unsigned long long slot = is_slot_ref(r) ? (unsigned long long)(slot_of(r) - chunk_of(r)->vals) : 15;
+            out.put_le((ids[cell(r)] + 1) << 4 | slot, 8);
+        };
+        auto put_value = [&](const Value &v) {
+            if (v.type == VT_INT) { out.put('i'); out.put_le((unsigned long long)v.ival, 8); }
+            else if (v.type == VT_BIG) {
+                out.put('b');
+                out.put(v.big->neg);
+                out.put_le((unsigned)v.big->mag.size(), 4);
+                for (uint32_t limb : v.big->mag) out.put_le(limb, 4);
+            }
+            else { out.put('l'); put_ref(v.lref); }
+        };
+        // post-order walk; the bool marks a cell whose children are already queued
+        vector<pair<ListRef, bool> > work;
+        for (size_t s = 0; s < env.frame.size(); ++s) {
+            const Value &root = env.frame[s];
+            if (!env.defined[s] || root.type != VT_LIST || !root.lref) continue;
+            work.push_back(make_pair(root.lref, false));
+            while (!work.empty()) {
+                ListRef r = work.back().first;
+                bool expanded = work.back().second;
+                work.pop_back();
+                if (ids.count(cell(r))) continue;
+                const IntChunk *c = is_slot_ref(r) ? chunk_of(r) : nullptr;
+                const ListNode *n = c ? nullptr : node_of(r);
+                ListRef next = c ? c->next.raw() : n->next.raw();
+                ListRef sub = n && n->v.type == VT_LIST ? n->v.lref : 0;
+                if (!expanded) {
+                    work.push_back(make_pair(r, true));
+                    if (next && !ids.count(cell(next))) work.push_back(make_pair(next, false));
+                    if (sub && !ids.count(cell(sub))) work.push_back(make_pair(sub, false));
+                    continue;
+                }
+                if (c) {
+                    out.put('C');
+                    out.put((char)c->lo);
+                    for (int i = (int)c->lo; i < IntChunk::SLOTS; ++i) out.put_le((unsigned long long)c->vals[i], 8);
+                } else {
+                    out.put('N');
+                    put_value(n->v);
+                }
+                put_ref(next);
+                unsigned long long id = ids.size();
+                ids[cell(r)] = id;
+            }
+        }
+        out.put('E');
+        for (size_t s = 0; s < env.frame.size(); ++s) {
+            out.put(env.defined[s] ? 1 : 0);
+            if (env.defined[s]) put_value(env.frame[s]);
+        }
+    }
+    f.close();
+    if (!f || rename(tmp.c_str(), cfg.path.c_str()) != 0) {
+        remove(tmp.c_str());
+        throw runtime_error("Unable to write file: " + cfg.path);
+    }
+}
+
+#ifndef PPL_NO_MAIN
+// Load a snapshot of the same program into a fresh env and return its pc,
+// which must be below pc_limit. Every id, slot and tag is checked.
+static int read_snapshot(const char *data, size_t size, Env &env, int engine, unsigned long long program, int pc_limit) {
+    size_t pos = 0;
+    auto bad = [](const char *what) { throw runtime_error(string("invalid snapshot: ") + what); };
+    auto get = [&](int bytes) {
+        if ((size_t)bytes > size - pos) bad("truncated");
+        unsigned long long v = 0;
+        for (int i = 0; i < bytes; ++i) v |= (unsigned long long)(unsigned char)data[pos + i] << (8 * i);
+        pos += bytes;
+        return v;
+    };
+    if (size < 4 || memcmp(data, "PPLS", 4) != 0) bad("bad magic");
+    pos = 4;
+    if (get(4) != PPLS_VERSION) bad("unsupported version");
+    if ((int)get(4) != engine) throw runtime_error("snapshot was taken on the other engine");
+    if (get(8) != program) throw runtime_error("snapshot was taken of a different program or -O level");
+    if (get(4) != env.frame.size()) bad("slot count");
+    unsigned long long pc = get(4);
+    if (pc >= (unsigned long long)pc_limit) bad("pc");
+
+    vector<ListPtr> cells; // one reference per cell while the graph is rebuilt
+    auto get_ref = [&]() -> ListRef {
+        unsigned long long v = get(8);
+        if (!v) return 0;
+        unsigned long long id = (v >> 4) - 1, slot = v & 15;
+        if (id >= cells.size()) bad("cell id");
+        ListRef r = cells[id].raw();
+        if (slot == 15) {
+            if (is_slot_ref(r)) bad("cell kind");
+            return r;
+        }
+        if (!is_slot_ref(r)) bad("cell kind");
+        IntChunk *c = chunk_of(r);
+        if (slot < c->lo || slot >= (unsigned long long)IntChunk::SLOTS) bad("chunk slot");
+        return slot_ref(&c->vals[slot]);
+    };
+    auto get_value = [&]() -> Value {
+        char tag = (char)get(1);
+        if (tag == 'i') return Value::make_int((long long)get(8));
+        if (tag == 'b') {
+            if (!env.big_ints) throw runtime_error("snapshot holds big ints: resume with --ints=big");
+            bool neg = get(1) != 0;
+            unsigned long long n = get(4);
+            if (n > (size - pos) / 4) bad("truncated");
+            vector<uint32_t> mag((size_t)n);
+            for (uint32_t &limb : mag) limb = (uint32_t)get(4);
+            return int_value(env.arena, neg, mag);
+        }
+        if (tag != 'l') bad("value tag");
+        return Value::make_list(ListPtr(get_ref()));
+    };
+    for (;;) {
+        char tag = (char)get(1);
+        if (tag == 'E') break;
+        if (tag == 'C') {
+            int lo = (int)get(1);
+            if (lo >= IntChunk::SLOTS) bad("chunk");
+            IntChunk *c = env.arena.new_chunk(lo);
+            ListPtr held(slot_ref(&c->vals[lo]));
+            for (int i = lo; i < IntChunk::SLOTS; ++i) c->vals[i] = (long long)get(8);
+            c->next = ListPtr(get_ref());
+            c->next_len = stored_len(list_length(c->next.raw()));
+            if (env.arena.hashcons)
+                for (int i = IntChunk::SLOTS; i-- > lo;) env.arena.intern(slot_ref(&c->vals[i]));
+            cells.push_back(move(held));
+        } else if (tag == 'N') {
+            Value v = get_value();
+            ListRef next = get_ref();
+            cells.push_back(env.arena.make(move(v), ListPtr(next)));
+            if (env.arena.hashcons) env.arena.intern(cells.back().raw());
+        } else {
+            bad("cell tag");
+        }
+    }
+    for (size_t s = 0; s < env.frame.size(); ++s) {
+        unsigned long long def = get(1);
+        if (def > 1) bad("slot");
+        if (def) env.set((int)s, get_value());
+    }
+    if (pos != size) bad("trailing data");
+    return (int)pc;
+}
+#endif
+
+// Write a checkpoint without stopping the run: a forked child writes the
+// copy-on-write image of the heap while the parent carries on. Skipped if
+// the previous one is still being written.
+static void checkpoint_in_background(const Env &env, int pc, SnapshotConfig &cfg) {
+    if (cfg.writer > 0) {
+        if (waitpid(cfg.writer, nullptr, WNOHANG) == 0) return;
+        cfg.writer = 0;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        int rc = 0;
+        try {
+            write_snapshot(env, pc, cfg);
+        } catch (const exception &e) {
+            fprintf(stderr, "Error writing snapshot: %s\n", e.what());
+            rc = 1;
+        }
+        _exit(rc); // never run the parent's atexit handlers or flush its buffers
+    }
+    if (pid < 0) write_snapshot(env, pc, cfg);
+    else cfg.writer = pid;
+}
+
+static void limit_hit(const string &what) PPL_COLD;
+static void limit_hit(const string &what) { throw LimitExceeded(what); }
+
+// Step, time and snapshot budget of one run. Engines call due() on every
+// backward jump, so a straight-line stretch runs unchecked but no loop can;
+// the clock is only read every 1024 calls. When due() says so the engine
+// calls back_edge() with the pc it is about to jump to. --max-memory is
+// enforced by the arena.
+struct Budget {
+    bool active;
+    bool timed;
+    long long max_steps;
+    double timeout;
+    chrono::steady_clock::time_point deadline;
+    unsigned ticks;
+    const Env &env;
+    SnapshotConfig *snap;
+
+    explicit Budget(const Env &e)
+        : active(e.limits.max_steps > 0 || e.limits.timeout > 0 || e.snapshot),
+          timed(e.limits.timeout > 0 || (e.snapshot && e.snapshot->every > 0)),
+          max_steps(e.limits.max_steps > 0 ? e.limits.max_steps : LLONG_MAX),
+          timeout(e.limits.timeout), ticks(0), env(e), snap(e.snapshot) {
+        auto now = chrono::steady_clock::now();
+        if (timeout > 0) deadline = now + seconds(timeout);
+        if (snap && snap->every > 0) snap->next_due = now + seconds(snap->every);
+    }
+
+    static chrono::steady_clock::duration seconds(double s) {
+        return chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(s));
+    }
+
+    // read_clock: the caller just did a lot of work, look at the clock now
+    bool due(long long steps, bool read_clock = false) {
+        return steps > max_steps || (snap && suspend_requested) || (timed && (read_clock || (++ticks & 1023) == 0));
+    }
+
+    void back_edge(int pc, long long steps) {
+        if (steps > max_steps) stop("max-steps " + to_string(max_steps), pc);
+        if (snap && suspend_requested) stop("suspended", pc, true);
+        if (!timed) return;
+        auto now = chrono::steady_clock::now();
+        if (timeout > 0 && now >= deadline) {
+            char buf[48];
+            snprintf(buf, sizeof buf, "timeout %g s", timeout);
+            stop(buf, pc);
+        }
+        if (snap && snap->every > 0 && now >= snap->next_due) {
+            checkpoint_in_background(env, pc, *snap);
+            snap->next_due = now + seconds(snap->every);
+        }
+    }
+
+    // With --snapshot, a stopped run can be resumed from where it stopped
+    void stop(const string &what, int pc, bool suspend = false) {
+        if (!snap) limit_hit(what);
+        snap->wait();
+        write_snapshot(env, pc, *snap);
+        LimitExceeded e(what);
+        e.snapshot = snap->path;
+        e.suspended = suspend;
+        throw e;
+    }
+
+    // Full iterations of an accelerated loop the step budget still allows
+    unsigned long long loop_iterations(long long steps, long long iter_steps) const {
+        if (max_steps == LLONG_MAX) return ULLONG_MAX;
+        return steps >= max_steps ? 0 : (unsigned long long)((max_steps - steps) / iter_steps);
+    }
+};
+
+// Opcodes shared by the classic and bytecode engines
+enum Opcode {
+    OP_NOP, OP_INTEGER, OP_LIST, OP_MERGE, OP_COPY, OP_HEAD, OP_TAIL,
+    OP_ASSIGN, OP_CHS, OP_ADD, OP_IF, OP_HLT, OP_LEN,
+    OP_SUM, OP_RANGE, OP_FILL, OP_REVERSE, OP_CONCAT,
+    // superinstructions from optimize_program
+    OP_SUB, OP_JMP, OP_POP,
+    // bytecode only: accelerated counted loop (-O2)
+    OP_LOOP,
+    // bytecode only: variants whose operand checks specialize_checks proved (-O1)
+    OP_INTEGER_U, OP_LIST_U, OP_MERGE_U, OP_COPY_U, OP_HEAD_U, OP_TAIL_U,
+    OP_ASSIGN_U, OP_CHS_U, OP_ADD_U, OP_IF_INT, OP_IF_LIST, OP_SUB_U, OP_POP_U, OP_LEN_U,
+    OP_COUNT
+};
+
+static const char *const op_names[OP_COUNT] = {
+    "NOP", "INTEGER", "LIST", "MERGE", "COPY", "HEAD", "TAIL",
+    "ASSIGN", "CHS", "ADD", "IF", "HLT", "LEN",
+    "SUM", "RANGE", "FILL", "REVERSE", "CONCAT",
+    "SUB", "JMP", "POP",
+    "LOOP",
+    "INTEGER.u", "LIST.u", "MERGE.u", "COPY.u", "HEAD.u", "TAIL.u",
+    "ASSIGN.u", "CHS.u", "ADD.u", "IF.int", "IF.list", "SUB.u", "POP.u", "LEN.u"
+};
+
+// Fixed-size bytecode record: opcode + operand slots + constant/jump target.
+// For IF and JMP, imm is the target pc and b the resolved code index (-1 if out of range).
+// SUB keeps the line of its ADD in imm for error messages.
+struct BInstr {
+    long long imm;
+    int a, b;
+    int line;
+    int op;
+};
+
+// Base Instruction class (Command)
+struct Instruction {
+    int lineNo;
+    Instruction(int l=0): lineNo(l) {}
+    virtual ~Instruction() {}
+    // Fill the bytecode record for this instruction.
+    virtual void lower(BInstr &out) const = 0;
+    // Renumber the slots it names: slot s becomes to[s]
+    virtual void remap(const vector<int> &) {}
+    // execute returns next instruction index (1-based line number). Return -1 for HLT/terminate.
+    virtual int execute(Env &env, int pc, const vector<Instruction*> &program) const = 0;
+};
+
+// Non-owning view of a token inside the loaded program text
+struct Span {
+    const char *p;
+    size_t n;
+    string str() const { return string(p, n); }
+    bool operator==(const char *lit) const { return strlen(lit) == n && memcmp(p, lit, n) == 0; }
+};
+
+// Tokens of one line. Only the first MAX are kept (no line needs more),
+// but all are counted so arity errors stay exact.
+struct Tokens {
+    static const size_t MAX = 4;
+    Span tok[MAX];
+    size_t count;
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const Span &operator[](size_t i) const { return tok[i]; }
+};
+
+// Same separators as operator>> in the C locale
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Single pass over one line, no allocation
+static void tokenize(const char *p, const char *end, Tokens &t) {
+    t.count = 0;
+    for (;;) {
+        while (p < end && is_space(*p)) ++p;
+        if (p == end) return;
+        const char *start = p;
+        while (p < end && !is_space(*p)) ++p;
+        if (t.count < Tokens::MAX) { t.tok[t.count].p = start; t.tok[t.count].n = (size_t)(p - start); }
+        ++t.count;
+    }
+}
+
+// parse decimal integer: optional sign and digits only, no overflow, no exceptions
+static long long to_int_const(const Span &s, bool &ok) {
+    ok = false;
+    size_t i = 0;
+    bool neg = false;
+    if (i < s.n && (s.p[i] == '+' || s.p[i] == '-')) neg = s.p[i++] == '-';
+    if (i == s.n) return 0;
+    unsigned long long v = 0, limit = neg ? 9223372036854775808ULL : 9223372036854775807ULL;
+    for (; i < s.n; ++i) {
+        unsigned d = (unsigned char)s.p[i] - '0';
+        if (d > 9) return 0;
+        if (v > (limit - d) / 10) return 0;
+        v = v * 10 + d;
+    }
+    ok = true;
+    return neg ? (long long)(0 - v) : (long long)v;
+}
+
+// Helper to check identifier name validity (simple)
+static bool is_identifier(const Span &s) {
+    if (s.n == 0) return false;
+    unsigned char c0 = (unsigned char)s.p[0];
+    if (!isalpha(c0) && c0 != '_') return false;
+    for (size_t i = 0; i < s.n; ++i) {
+        unsigned char c = (unsigned char)s.p[i];
+        if (!isalnum(c) && c != '_') return false;
+    }
+    return true;
+}
+
+// Concrete instructions
+
+struct Instr_INTEGER : Instruction {
+    int sid;
+    Instr_INTEGER(int l, int sid_) : Instruction(l), sid(sid_) {}
+    void lower(BInstr &out) const override { out.op = OP_INTEGER; out.a = sid; }
+    void remap(const vector<int> &to) override { sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (env.exists(sid)) throw runtime_error("Line " + to_string(lineNo) + ": Identifier already declared: " + env.name(sid));
+        env.set(sid, Value::make_int(0));
+        return pc + 1;
+    }
+};
+
+struct Instr_LIST : Instruction {
+    int sid;
+    Instr_LIST(int l, int sid_) : Instruction(l), sid(sid_) {}
+    void lower(BInstr &out) const override { out.op = OP_LIST; out.a = sid; }
+    void remap(const vector<int> &to) override { sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (env.exists(sid)) throw runtime_error("Line " + to_string(lineNo) + ": Identifier already declared: " + env.name(sid));
+        env.set(sid, Value::make_list(nullptr));
+        return pc + 1;
+    }
+};
+
+struct Instr_MERGE : Instruction {
+    int sfrom, sto;
+    Instr_MERGE(int l, int a, int b) : Instruction(l), sfrom(a), sto(b) {}
+    void lower(BInstr &out) const override { out.op = OP_MERGE; out.a = sfrom; out.b = sto; }
+    void remap(const vector<int> &to) override { sfrom = to[sfrom]; sto = to[sto]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sfrom)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined identifier: " + env.name(sfrom));
+        if (!env.exists(sto)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list identifier: " + env.name(sto));
+        Value vfrom = value_copy(env.get_const(sfrom), env.persistent_lists); // copy of value inserted
+        Value &target = env.get(sto);
+        if (target.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": MERGE target is not a list: " + env.name(sto));
+        env.arena.push_front(target, move(vfrom)); // prepend
+        return pc + 1;
+    }
+};
+
+struct Instr_COPY : Instruction {
+    int ssrc, sdst;
+    Instr_COPY(int l, int a, int b) : Instruction(l), ssrc(a), sdst(b) {}
+    void lower(BInstr &out) const override { out.op = OP_COPY; out.a = ssrc; out.b = sdst; }
+    void remap(const vector<int> &to) override { ssrc = to[ssrc]; sdst = to[sdst]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(ssrc)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined source: " + env.name(ssrc));
+        const Value &v = env.get_const(ssrc);
+        if (v.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": COPY source is not a list: " + env.name(ssrc));
+        if (sdst != ssrc) env.set(sdst, value_copy(v, env.persistent_lists)); // COPY A A changes nothing
+        return pc + 1;
+    }
+};
+
+struct Instr_HEAD : Instruction {
+    int slist, sid;
+    Instr_HEAD(int l, int listid_, int id_) : Instruction(l), slist(listid_), sid(id_) {}
+    void lower(BInstr &out) const override { out.op = OP_HEAD; out.a = slist; out.b = sid; }
+    void remap(const vector<int> &to) override { slist = to[slist]; sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(slist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(slist));
+        const Value &lv = env.get_const(slist);
+        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": HEAD target not a list: " + env.name(slist));
+        if (!lv.lref) throw runtime_error("Line " + to_string(lineNo) + ": HEAD on empty list: " + env.name(slist));
+        env.set(sid, value_copy(list_first(lv.lref), env.persistent_lists)); // create or replace id
+        return pc + 1;
+    }
+};
+
+struct Instr_TAIL : Instruction {
+    int ssrc, sdst;
+    Instr_TAIL(int l, int a, int b) : Instruction(l), ssrc(a), sdst(b) {}
+    void lower(BInstr &out) const override { out.op = OP_TAIL; out.a = ssrc; out.b = sdst; }
+    void remap(const vector<int> &to) override { ssrc = to[ssrc]; sdst = to[sdst]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(ssrc)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(ssrc));
+        const Value &sv = env.get_const(ssrc);
+        if (sv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": TAIL source not a list: " + env.name(ssrc));
+        // nodes from head->next onward (TAIL of empty list is empty)
+        if (sdst == ssrc) list_drop_front(env.get(sdst), env.persistent_lists);
+        else env.set(sdst, Value::make_list(list_tail(sv.lref, env.persistent_lists)));
+        return pc + 1;
+    }
+};
+
+struct Instr_LEN : Instruction {
+    int slist, sid;
+    Instr_LEN(int l, int listid_, int id_) : Instruction(l), slist(listid_), sid(id_) {}
+    void lower(BInstr &out) const override { out.op = OP_LEN; out.a = slist; out.b = sid; }
+    void remap(const vector<int> &to) override { slist = to[slist]; sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(slist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(slist));
+        const Value &lv = env.get_const(slist);
+        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": LEN target not a list: " + env.name(slist));
+        env.set(sid, Value::make_int((long long)list_length(lv.lref))); // create or replace id
+        return pc + 1;
+    }
+};
+
+struct Instr_SUM : Instruction {
+    int slist, sid;
+    Instr_SUM(int l, int listid_, int id_) : Instruction(l), slist(listid_), sid(id_) {}
+    void lower(BInstr &out) const override { out.op = OP_SUM; out.a = slist; out.b = sid; }
+    void remap(const vector<int> &to) override { slist = to[slist]; sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(slist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(slist));
+        const Value &lv = env.get_const(slist);
+        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": SUM target not a list: " + env.name(slist));
+        Value sum;
+        if (!list_sum(lv.lref, sum, env.big_ints, env.arena)) throw runtime_error("Line " + to_string(lineNo) + ": SUM element not an int: " + env.name(slist));
+        env.set(sid, move(sum)); // create or replace id
+        return pc + 1;
+    }
+};
+
+struct Instr_RANGE : Instruction {
+    int scount, sdst;
+    Instr_RANGE(int l, int a, int b) : Instruction(l), scount(a), sdst(b) {}
+    void lower(BInstr &out) const override { out.op = OP_RANGE; out.a = scount; out.b = sdst; }
+    void remap(const vector<int> &to) override { scount = to[scount]; sdst = to[sdst]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(scount)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined identifier: " + env.name(scount));
+        const Value &n = env.get_const(scount);
+        if (!n.is_int()) throw runtime_error("Line " + to_string(lineNo) + ": RANGE count not an int: " + env.name(scount));
+        if (n.type == VT_BIG ? n.big->neg : n.ival < 0) throw runtime_error("Line " + to_string(lineNo) + ": RANGE count is negative: " + env.name(scount));
+        if (n.type == VT_BIG || n.ival > UINT_MAX) throw runtime_error("Line " + to_string(lineNo) + ": RANGE count too large: " + env.name(scount));
+        env.set(sdst, Value::make_list(list_range(env.arena, (size_t)n.ival)));
+        return pc + 1;
+    }
+};
+
+struct Instr_FILL : Instruction {
+    int sval, slist;
+    Instr_FILL(int l, int a, int b) : Instruction(l), sval(a), slist(b) {}
+    void lower(BInstr &out) const override { out.op = OP_FILL; out.a = sval; out.b = slist; }
+    void remap(const vector<int> &to) override { sval = to[sval]; slist = to[slist]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sval)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined identifier: " + env.name(sval));
+        if (!env.exists(slist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list identifier: " + env.name(slist));
+        const Value &lv = env.get_const(slist);
+        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": FILL target is not a list: " + env.name(slist));
+        env.set(slist, Value::make_list(list_fill(env.arena, env.get_const(sval), list_length(lv.lref), env.persistent_lists)));
+        return pc + 1;
+    }
+};
+
+struct Instr_REVERSE : Instruction {
+    int slist;
+    Instr_REVERSE(int l, int listid_) : Instruction(l), slist(listid_) {}
+    void lower(BInstr &out) const override { out.op = OP_REVERSE; out.a = slist; }
+    void remap(const vector<int> &to) override { slist = to[slist]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(slist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(slist));
+        const Value &lv = env.get_const(slist);
+        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": REVERSE target not a list: " + env.name(slist));
+        env.set(slist, Value::make_list(list_reverse(env.arena, lv.lref, env.persistent_lists)));
+        return pc + 1;
+    }
+};
+
+struct Instr_CONCAT : Instruction {
+    int sfrom, sto;
+    Instr_CONCAT(int l, int a, int b) : Instruction(l), sfrom(a), sto(b) {}
+    void lower(BInstr &out) const override { out.op = OP_CONCAT; out.a = sfrom; out.b = sto; }
+    void remap(const vector<int> &to) override { sfrom = to[sfrom]; sto = to[sto]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sfrom)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(sfrom));
+        if (!env.exists(sto)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list identifier: " + env.name(sto));
+        const Value &src = env.get_const(sfrom), &target = env.get_const(sto);
+        if (src.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": CONCAT source is not a list: " + env.name(sfrom));
+        if (target.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": CONCAT target is not a list: " + env.name(sto));
+        // prepend a copy of every element of the source
+        env.set(sto, Value::make_list(list_concat(env.arena, src.lref, ListPtr(target.lref), env.persistent_lists)));
+        return pc + 1;
+    }
+};
+
+struct Instr_ASSIGN : Instruction {
+    int sid;
+    long long val;
+    Instr_ASSIGN(int l, int sid_, long long v_) : Instruction(l), sid(sid_), val(v_) {}
+    void lower(BInstr &out) const override { out.op = OP_ASSIGN; out.a = sid; out.imm = val; }
+    void remap(const vector<int> &to) override { sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (env.exists(sid)) {
+            Value &existing = env.get(sid);
+            if (!existing.is_int()) throw runtime_error("Line " + to_string(lineNo) + ": ASSIGN to non-int: " + env.name(sid));
+            if (existing.type == VT_BIG) existing = Value();
+            existing.ival = val;
+        } else {
+            env.set(sid, Value::make_int(val));
+        }
+        return pc + 1;
+    }
+};
+
+struct Instr_CHS : Instruction {
+    int sid;
+    Instr_CHS(int l, int sid_) : Instruction(l), sid(sid_) {}
+    void lower(BInstr &out) const override { out.op = OP_CHS; out.a = sid; }
+    void remap(const vector<int> &to) override { sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sid)) throw runtime_error("Line " + to_string(lineNo) + ": CHS undefined id: " + env.name(sid));
+        Value &v = env.get(sid);
+        if (!v.is_int()) throw runtime_error("Line " + to_string(lineNo) + ": CHS on non-int: " + env.name(sid));
+        int_neg(v, env.big_ints, env.arena);
+        return pc + 1;
+    }
+};
+
+struct Instr_ADD : Instruction {
+    int sa, sb;
+    Instr_ADD(int l, int a_, int b_) : Instruction(l), sa(a_), sb(b_) {}
+    void lower(BInstr &out) const override { out.op = OP_ADD; out.a = sa; out.b = sb; }
+    void remap(const vector<int> &to) override { sa = to[sa]; sb = to[sb]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sa)) throw runtime_error("Line " + to_string(lineNo) + ": ADD undefined id: " + env.name(sa));
+        if (!env.exists(sb)) throw runtime_error("Line " + to_string(lineNo) + ": ADD undefined id: " + env.name(sb));
+        Value &va = env.get(sa);
+        Value &vb = env.get(sb);
+        if (!va.is_int() || !vb.is_int()) throw runtime_error("Line " + to_string(lineNo) + ": ADD type error");
+        int_add(va, vb, env.big_ints, env.arena);
+        return pc + 1;
+    }
+};
+
+struct Instr_IF : Instruction {
+    int sid;
+    int target;
+    Instr_IF(int l, int sid_, int target_) : Instruction(l), sid(sid_), target(target_) {}
+    void lower(BInstr &out) const override { out.op = OP_IF; out.a = sid; out.imm = target; }
+    void remap(const vector<int> &to) override { sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sid)) throw runtime_error("Line " + to_string(lineNo) + ": IF undefined id: " + env.name(sid));
+        const Value &v = env.get_const(sid);
+        bool cond = false;
+        if (v.type == VT_INT) cond = (v.ival == 0);
+        else cond = (v.lref == 0); // the empty list; never a big, whose pointer shares lref
+        if (cond) {
+            if (target < 1 || target > (int)program.size()) throw runtime_error("Line " + to_string(lineNo) + ": IF jump out of range: " + to_string(target));
+            return target; // line numbers are 1-based
+        } else return pc + 1;
+    }
+};
+
+struct Instr_HLT : Instruction {
+    Instr_HLT(int l) : Instruction(l) {}
+    void lower(BInstr &out) const override { out.op = OP_HLT; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        return -1; // terminate
+    }
+};
+
+// Blank line; removed again by optimize_program
+struct Instr_NOP : Instruction {
+    Instr_NOP(int l) : Instruction(l) {}
+    void lower(BInstr &out) const override { out.op = OP_NOP; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override { return pc + 1; }
+};
+
+// Superinstructions built by optimize_program. Each reports errors exactly as
+// the sequence it replaces would, including that sequence's line numbers.
+
+// CHS b; ADD a b; CHS b  =>  a -= b   (a != b)
+struct Instr_SUB : Instruction {
+    int sa, sb;
+    int addLine;
+    Instr_SUB(int l, int addLine_, int a_, int b_) : Instruction(l), sa(a_), sb(b_), addLine(addLine_) {}
+    void lower(BInstr &out) const override { out.op = OP_SUB; out.a = sa; out.b = sb; out.imm = addLine; }
+    void remap(const vector<int> &to) override { sa = to[sa]; sb = to[sb]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(sb)) throw runtime_error("Line " + to_string(lineNo) + ": CHS undefined id: " + env.name(sb));
+        Value &vb = env.get(sb);
+        if (!vb.is_int()) throw runtime_error("Line " + to_string(lineNo) + ": CHS on non-int: " + env.name(sb));
+        if (!env.exists(sa)) throw runtime_error("Line " + to_string(addLine) + ": ADD undefined id: " + env.name(sa));
+        Value &va = env.get(sa);
+        if (!va.is_int()) throw runtime_error("Line " + to_string(addLine) + ": ADD type error");
+        int_sub(va, vb, env.big_ints, env.arena);
+        return pc + 1;
+    }
+};
+
+// IF on an identifier known to be 0 at that point  =>  unconditional jump
+struct Instr_JMP : Instruction {
+    int target;
+    Instr_JMP(int l, int target_) : Instruction(l), target(target_) {}
+    void lower(BInstr &out) const override { out.op = OP_JMP; out.imm = target; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        return target;
+    }
+};
+
+// HEAD L x; TAIL L L  =>  pop the head of L into x   (x != L)
+struct Instr_POP : Instruction {
+    int slist, sid;
+    Instr_POP(int l, int listid_, int id_) : Instruction(l), slist(listid_), sid(id_) {}
+    void lower(BInstr &out) const override { out.op = OP_POP; out.a = slist; out.b = sid; }
+    void remap(const vector<int> &to) override { slist = to[slist]; sid = to[sid]; }
+    int execute(Env &env, int pc, const vector<Instruction*> &program) const override {
+        if (!env.exists(slist)) throw runtime_error("Line " + to_string(lineNo) + ": Undefined list: " + env.name(slist));
+        Value &lv = env.get(slist);
+        if (lv.type != VT_LIST) throw runtime_error("Line " + to_string(lineNo) + ": HEAD target not a list: " + env.name(slist));
+        if (!lv.lref) throw runtime_error("Line " + to_string(lineNo) + ": HEAD on empty list: " + env.name(slist));
+        env.set(sid, value_copy(list_first(lv.lref), env.persistent_lists));
+        list_drop_front(lv, env.persistent_lists);
+        return pc + 1;
+    }
+};
+
+void free_program(vector<Instruction*> &prog);
+
+// Parser: create an Instruction for each line, interning its identifiers
+Instruction* parse_line(const Tokens &t, int lineno, SymbolTable &syms) {
+    if (t.empty()) return nullptr; // allow blank lines (ignored)
+    const Span &op = t[0];
+    if (op == "INTEGER") {
+        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": INTEGER requires exactly one argument");
+        if (!is_identifier(t[1])) throw runtime_error("Line " + to_string(lineno) + ": invalid identifier: " + t[1].str());
+        return new Instr_INTEGER(lineno, syms.intern(t[1].p, t[1].n));
+    } else if (op == "LIST") {
+        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": LIST requires exactly one argument");
+        if (!is_identifier(t[1])) throw runtime_error("Line " + to_string(lineno) + ": invalid identifier: " + t[1].str());
+        return new Instr_LIST(lineno, syms.intern(t[1].p, t[1].n));
+    } else if (op == "MERGE") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": MERGE requires two arguments");
+        return new Instr_MERGE(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "COPY") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": COPY requires two arguments");
+        return new Instr_COPY(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "HEAD") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": HEAD requires two arguments");
+        return new Instr_HEAD(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "TAIL") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": TAIL requires two arguments");
+        return new Instr_TAIL(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "LEN") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": LEN requires two arguments");
+        return new Instr_LEN(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "SUM") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": SUM requires two arguments");
+        return new Instr_SUM(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "RANGE") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": RANGE requires two arguments");
+        return new Instr_RANGE(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "FILL") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": FILL requires two arguments");
+        return new Instr_FILL(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "REVERSE") {
+        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": REVERSE requires one argument");
+        return new Instr_REVERSE(lineno, syms.intern(t[1].p, t[1].n));
+    } else if (op == "CONCAT") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": CONCAT requires two arguments");
+        return new Instr_CONCAT(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "ASSIGN") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": ASSIGN requires two arguments");
+        bool ok=false; long long v = to_int_const(t[2], ok);
+        if (!ok) throw runtime_error("Line " + to_string(lineno) + ": ASSIGN needs integer constant, got: " + t[2].str());
+        return new Instr_ASSIGN(lineno, syms.intern(t[1].p, t[1].n), v);
+    } else if (op == "CHS") {
+        if (t.size() != 2) throw runtime_error("Line " + to_string(lineno) + ": CHS requires one argument");
+        return new Instr_CHS(lineno, syms.intern(t[1].p, t[1].n));
+    } else if (op == "ADD") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": ADD requires two arguments");
+        return new Instr_ADD(lineno, syms.intern(t[1].p, t[1].n), syms.intern(t[2].p, t[2].n));
+    } else if (op == "IF") {
+        if (t.size() != 3) throw runtime_error("Line " + to_string(lineno) + ": IF requires two arguments");
+        bool ok=false; int target = (int)to_int_const(t[2], ok);
+        if (!ok || target <= 0) throw runtime_error("Line " + to_string(lineno) + ": IF target must be positive integer");
+        return new Instr_IF(lineno, syms.intern(t[1].p, t[1].n), target);
+    } else if (op == "HLT") {
+        if (t.size() != 1) throw runtime_error("Line " + to_string(lineno) + ": HLT takes no arguments");
+        return new Instr_HLT(lineno);
+    } else {
+        throw runtime_error("Line " + to_string(lineno) + ": Unknown operation: " + op.str());
+    }
+}
+
+// Read-only view of a whole file: mmap for regular files, a heap copy otherwise
+struct MappedFile {
+    const char *data;
+    size_t size;
+    bool mapped;
+    string buf;
+
+    explicit MappedFile(const string &filename) : data(nullptr), size(0), mapped(false) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Unable to open file: " + filename);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(p);
+                size = (size_t)st.st_size;
+                mapped = true;
+            }
+        }
+        if (!mapped) {
+            char chunk[65536];
+            ssize_t n;
+            while ((n = read(fd, chunk, sizeof chunk)) > 0) buf.append(chunk, (size_t)n);
+            data = buf.data();
+            size = buf.size();
+        }
+        close(fd);
+    }
+    ~MappedFile() { if (mapped) munmap(const_cast<char*>(data), size); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+};
+
+// Parse the lines of [p, end), numbering them from lineno + 1, onto prog.
+// Blank lines become NOPs. prog keeps what was parsed if a line throws.
+static void parse_range(const char *p, const char *end, int lineno, SymbolTable &syms,
+                        vector<Instruction*> &prog) {
+    Tokens t;
+    while (p < end) {
+        const char *nl = static_cast<const char*>(memchr(p, '\n', (size_t)(end - p)));
+        const char *eol = nl ? nl : end;
+        ++lineno;
+        tokenize(p, eol, t);
+        //We parse a line to create a specific instruction.
+        Instruction *ins = parse_line(t, lineno, syms);
+        prog.push_back(ins ? ins : new Instr_NOP(lineno));
+        p = nl ? nl + 1 : end;
+    }
+}
+
+static int count_lines(const char *p, const char *end) {
+    int n = 0;
+    while ((p = static_cast<const char*>(memchr(p, '\n', (size_t)(end - p))))) { ++n; ++p; }
+    return n;
+}
+
+// Inputs smaller than this are parsed on the calling thread
+static const size_t PARALLEL_PARSE_MIN = 4 << 20;
+static const size_t PARALLEL_PARSE_CHUNK = 1 << 20;
+
+// Parse program text -> vector<Instruction*>. Lines split like getline: a
+// final line without a newline still counts, a trailing newline adds none.
+//
+// Large inputs are cut at newlines into one chunk per core. A first parallel
+// pass counts each chunk's lines so every chunk knows its first line number;
+// the second parses each chunk into its own instruction buffer against its own
+// SymbolTable. The merge then interns each chunk's names into syms in chunk
+// order and remaps the slots, so slot numbering is exactly the sequential
+// first-appearance order. IF targets are absolute line numbers and need no
+// fix-up. On errors the lowest chunk's exception is rethrown: it stopped at
+// its first bad line and every earlier chunk parsed cleanly, so the message is
+// the one a sequential parse would give.
+vector<Instruction*> parse_program(const char *text, size_t size, SymbolTable &syms) {
+    vector<Instruction*> prog;
+    const char *end = text + size;
+    unsigned cores = thread::hardware_concurrency();
+    size_t nchunks = min<size_t>(cores ? cores : 1, size / PARALLEL_PARSE_CHUNK);
+    if (size < PARALLEL_PARSE_MIN || nchunks < 2) {
+        try {
+            parse_range(text, end, 0, syms, prog);
+        } catch (...) {
+            free_program(prog);
+            throw;
+        }
+        return prog;
+    }
+
+    vector<const char*> cut(nchunks + 1);
+    cut[0] = text;
+    cut[nchunks] = end;
+    for (size_t c = 1; c < nchunks; ++c) {
+        const char *q = max(cut[c - 1], text + size / nchunks * c);
+        const char *nl = q < end ? static_cast<const char*>(memchr(q, '\n', (size_t)(end - q))) : nullptr;
+        cut[c] = nl ? nl + 1 : end;
+    }
+
+    vector<int> first(nchunks + 1, 0);
+    vector<SymbolTable> local(nchunks);
+    vector<vector<Instruction*>> part(nchunks);
+    vector<exception_ptr> err(nchunks);
+    auto in_parallel = [nchunks](const function<void(size_t)> &f) {
+        vector<thread> pool;
+        for (size_t c = 1; c < nchunks; ++c) pool.emplace_back(f, c);
+        f(0);
+        for (thread &th : pool) th.join();
+    };
+    in_parallel([&](size_t c) { first[c + 1] = count_lines(cut[c], cut[c + 1]); });
+    for (size_t c = 0; c < nchunks; ++c) first[c + 1] += first[c];
+    in_parallel([&](size_t c) {
+        try {
+            parse_range(cut[c], cut[c + 1], first[c], local[c], part[c]);
+        } catch (...) {
+            err[c] = current_exception();
+        }
+    });
+
+    for (size_t c = 0; c < nchunks; ++c) {
+        if (!err[c]) continue;
+        for (vector<Instruction*> &v : part) free_program(v);
+        rethrow_exception(err[c]);
+    }
+    prog.reserve((size_t)first[nchunks] + 1);
+    vector<int> to;
+    for (size_t c = 0; c < nchunks; ++c) {
+        const vector<string> &names = local[c].names;
+        to.resize(names.size());
+        bool same = true;
+        for (size_t s = 0; s < names.size(); ++s) {
+            to[s] = syms.intern(names[s]);
+            same = same && to[s] == (int)s;
+        }
+        for (Instruction *ins : part[c]) {
+            if (!same) ins->remap(to);
+            prog.push_back(ins);
+        }
+        vector<Instruction*>().swap(part[c]);
+    }
+    return prog;
+}
+
+// Read program file -> vector<Instruction*>; bytes receives the file size
+vector<Instruction*> load_program(const string &filename, SymbolTable &syms, size_t *bytes = nullptr) {
+    MappedFile f(filename);
+    if (bytes) *bytes = f.size;
+    return parse_program(f.data, f.size, syms);
+}
+
+void free_program(vector<Instruction*> &prog) {
+    for (Instruction* p : prog) delete p;
+    prog.clear();
+}
+
+// Peephole optimizer (-O1 and up). Runs after load_program on the
+// Instruction* vector, so both engines benefit:
+//   - ASSIGN t 0 / INTEGER t ... IF t L within one block becomes a JMP
+//   - CHS b; ADD a b; CHS b becomes SUB a b
+//   - HEAD L x; TAIL L L becomes POP L x
+//   - blank-line NOPs are dropped and IF/JMP targets renumbered
+// Nothing is fused across an instruction that something jumps to.
+
+static BInstr lowered(const Instruction *ins) {
+    BInstr r;
+    r.imm = 0; r.a = r.b = -1; r.line = ins->lineNo;
+    ins->lower(r);
+    return r;
+}
+
+// Slots an instruction may write (up to two, -1 if none)
+static void written_slots(const BInstr &r, int &w1, int &w2) {
+    w1 = w2 = -1;
+    switch (r.op) {
+    case OP_INTEGER: case OP_LIST: case OP_ASSIGN: case OP_CHS: case OP_ADD: w1 = r.a; break;
+    case OP_MERGE: case OP_COPY: case OP_HEAD: case OP_TAIL: case OP_LEN: w1 = r.b; break;
+    case OP_SUM: case OP_RANGE: case OP_FILL: case OP_CONCAT: w1 = r.b; break;
+    case OP_REVERSE: w1 = r.a; break;
+    case OP_SUB: case OP_POP: w1 = r.a; w2 = r.b; break;
+    default: break;
+    }
+}
+
+static bool is_jump(int op) { return op == OP_IF || op == OP_JMP; }
+
+void optimize_program(vector<Instruction*> &prog) {
+    const int n = (int)prog.size();
+    vector<BInstr> rec(n);
+    for (int i = 0; i < n; ++i) rec[i] = lowered(prog[i]);
+    vector<char> is_target(n + 1, 0);
+    for (int i = 0; i < n; ++i)
+        if (is_jump(rec[i].op) && rec[i].imm >= 1 && rec[i].imm <= n) is_target[rec[i].imm - 1] = 1;
+
+    // ASSIGN t 0 (or INTEGER t) ... IF t L: t is still 0 when the IF is reached.
+    // One forward pass: zero_at[t] holds the block epoch in which t was last
+    // set to 0; any IF, JMP, HLT or jump target starts a new block.
+    int nslots = 0;
+    for (int i = 0; i < n; ++i) nslots = max(nslots, max(rec[i].a, rec[i].b) + 1);
+    vector<int> zero_at(nslots, -1);
+    int epoch = 0;
+    for (int j = 0; j < n; ++j) {
+        if (is_target[j]) ++epoch;
+        if (rec[j].op == OP_IF) {
+            int t = rec[j].a;
+            if (zero_at[t] == epoch && rec[j].imm >= 1 && rec[j].imm <= n) {
+                Instruction *jmp = new Instr_JMP(prog[j]->lineNo, (int)rec[j].imm);
+                delete prog[j];
+                prog[j] = jmp;
+                rec[j] = lowered(jmp);
+            }
+            ++epoch;
+            continue;
+        }
+        if (rec[j].op == OP_HLT || rec[j].op == OP_JMP) { ++epoch; continue; }
+        int w1, w2;
+        written_slots(rec[j], w1, w2);
+        if (w1 >= 0) zero_at[w1] = -1;
+        if (w2 >= 0) zero_at[w2] = -1;
+        if ((rec[j].op == OP_ASSIGN && rec[j].imm == 0) || rec[j].op == OP_INTEGER) zero_at[rec[j].a] = epoch;
+    }
+
+    // Fuse short sequences of consecutive non-NOP instructions
+    vector<char> removed(n, 0);
+    auto next_real = [&](int i) {
+        // next non-NOP after i; -1 if a jump lands in between or we run out
+        for (++i; i < n; ++i) {
+            if (is_target[i]) return -1;
+            if (rec[i].op != OP_NOP) return i;
+        }
+        return -1;
+    };
+    for (int i = 0; i < n; ++i) {
+        if (removed[i]) continue;
+        if (rec[i].op == OP_CHS) {
+            int j = next_real(i), k = j < 0 ? -1 : next_real(j);
+            if (k < 0) continue;
+            int b = rec[i].a;
+            if (rec[j].op == OP_ADD && rec[j].b == b && rec[j].a != b && rec[k].op == OP_CHS && rec[k].a == b) {
+                Instruction *sub = new Instr_SUB(prog[i]->lineNo, prog[j]->lineNo, rec[j].a, rec[j].b);
+                delete prog[i];
+                prog[i] = sub;
+                rec[i] = lowered(sub);
+                for (int r = i + 1; r <= k; ++r) removed[r] = 1;
+            }
+        } else if (rec[i].op == OP_HEAD) {
+            int j = next_real(i);
+            if (j < 0) continue;
+            int L = rec[i].a, x = rec[i].b;
+            if (x != L && rec[j].op == OP_TAIL && rec[j].a == L && rec[j].b == L) {
+                Instruction *pop = new Instr_POP(prog[i]->lineNo, L, x);
+                delete prog[i];
+                prog[i] = pop;
+                rec[i] = lowered(pop);
+                for (int r = i + 1; r <= j; ++r) removed[r] = 1;
+            }
+        }
+    }
+
+    // Drop NOPs and fused-away instructions. A removed instruction's pc maps
+    // to the next survivor; a jump past the last survivor still has to fall
+    // off the end rather than fail the range check, so it gets a NOP pad.
+    for (int i = 0; i < n; ++i) if (rec[i].op == OP_NOP) removed[i] = 1;
+    vector<Instruction*> out;
+    vector<int> newpc(n + 1);
+    for (int i = 0; i < n; ++i) {
+        if (removed[i]) { delete prog[i]; continue; }
+        out.push_back(prog[i]);
+        newpc[i] = (int)out.size();
+    }
+    newpc[n] = (int)out.size() + 1;
+    bool pad = false;
+    for (int i = n - 1; i >= 0 && removed[i]; --i) if (is_target[i]) pad = true;
+    for (int i = n - 1; i >= 0; --i) if (removed[i]) newpc[i] = newpc[i + 1];
+    if (pad) out.push_back(new Instr_NOP(n));
+    for (Instruction *ins : out) {
+        if (Instr_IF *iff = dynamic_cast<Instr_IF*>(ins)) {
+            if (iff->target >= 1 && iff->target <= n) iff->target = newpc[iff->target - 1];
+        } else if (Instr_JMP *jmp = dynamic_cast<Instr_JMP*>(ins)) {
+            jmp->target = newpc[jmp->target - 1];
+        }
+    }
+    prog.swap(out);
+}
+
+// High-water marks of the list arena, for --arena-stats
+void print_arena_stats(const ListArena &a, ostream &os) {
+    os << "arena: live=" << a.live << " peak=" << a.peak << " allocated=" << a.total
+       << " slabs=" << a.nslabs << " bytes=" << a.bytes()
+       << " (node " << sizeof(ListNode) << " B, chunk " << sizeof(IntChunk) << " B)";
+    if (a.hashcons) os << " interned=" << a.interned << " shared=" << a.shared;
+    os << "\n";
+}
+
+// Print all defined identifiers sorted
+void print_env(const Env &env, ostream &os = cout, OutputFormat fmt = OUT_TEXT) {
+    vector<int> order = env.syms->sorted_slots();
+    OutBuf out(os);
+    if (fmt == OUT_BINARY) {
+        unsigned count = 0;
+        for (int slot : order) count += env.exists(slot);
+        out.write("PPLV", 4);
+        out.put_le(env.big_ints ? 2 : 1, 4);
+        out.put_le(count, 4);
+    } else if (fmt == OUT_JSON) {
+        out.put('{');
+    }
+    bool first = true;
+    for (int slot : order) {
+        if (!env.exists(slot)) continue;
+        const string &name = env.name(slot);
+        if (fmt == OUT_TEXT) {
+            out.write(name);
+            out.write(" = ", 3);
+        } else if (fmt == OUT_JSON) {
+            if (!first) out.put(',');
+            out.put('"');
+            out.write(name); // identifiers never need escaping
+            out.write("\":", 2);
+        } else {
+            out.put_le(name.size(), 4);
+            out.write(name);
+        }
+        write_value(out, env.get_const(slot), fmt);
+        if (fmt == OUT_TEXT) out.put('\n');
+        first = false;
+    }
+    if (fmt == OUT_JSON) out.write("}\n", 2);
+}
+
+// Profiler for --profile. Engines are instantiated with and without it, so
+// the unprofiled loops carry no instrumentation at all. Each step charges the
+// ticks since the previous step to the instruction that was running.
+static inline unsigned long long prof_ticks() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct Profile {
+    static const bool ON = true;
+    vector<int> ops, lines;                // per program index
+    vector<unsigned long long> count, ticks;
+    int cur;
+    unsigned long long last, start_ticks;
+    chrono::steady_clock::time_point start_wall;
+    double wall_s;
+
+    Profile() : cur(-1), last(0), start_ticks(0), wall_s(0) {}
+
+    // One entry per engine pc index: program instructions or bytecode records
+    void init(const vector<BInstr> &code) {
+        ops.resize(code.size());
+        lines.resize(code.size());
+        for (size_t i = 0; i < code.size(); ++i) {
+            ops[i] = code[i].op;
+            lines[i] = code[i].line;
+        }
+        count.assign(code.size(), 0);
+        ticks.assign(code.size(), 0);
+    }
+    void init(const vector<Instruction*> &prog) {
+        vector<BInstr> code;
+        for (Instruction *ins : prog) code.push_back(lowered(ins));
+        init(code);
+    }
+    void begin() {
+        cur = -1;
+        start_wall = chrono::steady_clock::now();
+        start_ticks = last = prof_ticks();
+    }
+    // Called as instruction idx starts; idx < 0 ends the run.
+    void step(int idx) {
+        unsigned long long now = prof_ticks();
+        if (cur >= 0) { ++count[cur]; ticks[cur] += now - last; }
+        cur = idx;
+        last = now;
+    }
+    // sentinel: the run stopped on the end sentinel, which is not a program line
+    void end(bool sentinel = false) {
+        if (sentinel) cur = -1;
+        step(-1);
+        wall_s = chrono::duration<double>(chrono::steady_clock::now() - start_wall).count();
+    }
+    void report(ostream &os) const;
+};
+
+void Profile::report(ostream &os) const {
+    unsigned long long total_ticks = last - start_ticks, total_count = 0;
+    for (unsigned long long c : count) total_count += c;
+    double ns_per_tick = total_ticks ? wall_s * 1e9 / total_ticks : 0;
+    double denom = total_ticks ? (double)total_ticks : 1;
+
+    unsigned long long op_count[OP_COUNT] = {0}, op_ticks[OP_COUNT] = {0};
+    for (size_t i = 0; i < count.size(); ++i) { op_count[ops[i]] += count[i]; op_ticks[ops[i]] += ticks[i]; }
+    vector<int> order;
+    for (int op = 0; op < OP_COUNT; ++op) if (op_count[op]) order.push_back(op);
+    sort(order.begin(), order.end(), [&](int a, int b) { return op_ticks[a] > op_ticks[b]; });
+
+    os << "profile: " << total_count << " instructions in " << wall_s * 1e3 << " ms\n";
+    os << "  opcode        count         ns  %time   ns/op\n";
+    char buf[160];
+    for (int op : order) {
+        snprintf(buf, sizeof buf, "  %-8s %10llu %10.0f %6.2f %7.2f\n", op_names[op], op_count[op],
+                 op_ticks[op] * ns_per_tick, 100.0 * op_ticks[op] / denom, op_ticks[op] * ns_per_tick / op_count[op]);
+        os << buf;
+    }
+
+    vector<int> hot;
+    for (size_t i = 0; i < count.size(); ++i) if (count[i]) hot.push_back((int)i);
+    sort(hot.begin(), hot.end(), [&](int a, int b) { return ticks[a] != ticks[b] ? ticks[a] > ticks[b] : a < b; });
+    if (hot.size() > 20) hot.resize(20);
+    os << "  hot lines:\n    line  opcode        count         ns  %time\n";
+    for (int i : hot) {
+        snprintf(buf, sizeof buf, "  %6d  %-8s %10llu %10.0f %6.2f\n", lines[i], op_names[ops[i]], count[i],
+                 ticks[i] * ns_per_tick, 100.0 * ticks[i] / denom);
+        os << buf;
+    }
+}
+
+// Engines without a hook: every call compiles away
+struct NoHook {
+    static const bool ON = false;
+    void begin() {}
+    void step(int) {}
+    void end(bool = false) {}
+};
+
+// --trace=N: the last N steps of a run in a ring of fixed-size binary
+// entries, each the engine index, line and opcode of an instruction and its
+// slot operands as they were before it ran. The engine thread is the only
+// writer; it fills an entry, then publishes it by bumping head, so a signal
+// handler can dump the ring at any point. On a runtime error, a limit or a
+// fatal signal the ring goes to the trace file. --decode-trace maps it back
+// to source lines and names. Little-endian, host layout:
+//   "PPLT" u32 version, u32 engine, u64 program hash, u64 steps, u32 count,
+//   then count TraceEntry records, oldest first
+static const uint32_t PPLT_VERSION = 1;
+
+enum TraceTag { TT_NONE, TT_INT, TT_LIST, TT_BIG }; // a list records its length, a big its signed limb count
+
+struct TraceEntry {
+    uint32_t index;
+    int32_t line;
+    uint16_t op;
+    uint8_t ta, tb;
+    uint32_t pad;
+    int64_t a, b;
+};
+
+// Which operands of a record are slots; -1 for the others
+static void trace_slots(const BInstr &r, int &a, int &b) {
+    switch (r.op) {
+    case OP_NOP: case OP_HLT: case OP_JMP: case OP_LOOP: a = -1; break;
+    default: a = r.a;
+    }
+    switch (r.op) {
+    case OP_MERGE: case OP_COPY: case OP_HEAD: case OP_TAIL: case OP_ADD: case OP_LEN: case OP_SUM: case OP_RANGE:
+    case OP_FILL: case OP_CONCAT: case OP_SUB: case OP_POP: case OP_MERGE_U: case OP_COPY_U: case OP_HEAD_U:
+    case OP_TAIL_U: case OP_ADD_U: case OP_SUB_U: case OP_POP_U: case OP_LEN_U:
+        b = r.b; break;
+    default: b = -1;
+    }
+}
+
+struct Trace {
+    static const bool ON = true;
+    struct Meta { int a, b, line, op; };
+    vector<Meta> meta;          // per engine index
+    vector<TraceEntry> ring;    // a power of two
+    size_t mask;
+    atomic<uint64_t> head;      // entries ever written
+    const Value *F;
+    const char *D;
+    uint32_t engine;            // SnapshotEngine of the run
+    uint64_t program;           // program_hash of the run
+    string path;                // --trace-file
+
+    explicit Trace(size_t n) : mask(0), head(0), F(nullptr), D(nullptr), engine(0), program(0) {
+        size_t cap = 16;
+        while (cap < n) cap *= 2;
+        ring.resize(cap);
+        mask = cap - 1;
+    }
+
+    void init(const vector<BInstr> &code) {
+        meta.resize(code.size());
+        for (size_t i = 0; i < code.size(); ++i) {
+            trace_slots(code[i], meta[i].a, meta[i].b);
+            meta[i].line = code[i].line;
+            meta[i].op = code[i].op;
+        }
+    }
+    void init(const vector<Instruction*> &prog) {
+        vector<BInstr> code;
+        for (Instruction *ins : prog) code.push_back(lowered(ins));
+        init(code);
+    }
+    // The frame is read in place, so it must not move during the run
+    void bind(const Env &env) {
+        F = env.frame.data();
+        D = env.defined.data();
+    }
+
+    PPL_INLINE void operand(int slot, uint8_t &tag, int64_t &x) const {
+        if (slot < 0 || !D[slot]) { tag = TT_NONE; x = 0; return; }
+        const Value &v = F[slot];
+        if (v.type == VT_INT) { tag = TT_INT; x = v.ival; }
+        else if (v.type == VT_LIST) { tag = TT_LIST; x = (int64_t)list_length(v.lref); }
+        else { tag = TT_BIG; x = v.big->neg ? -(int64_t)v.big->mag.size() : (int64_t)v.big->mag.size(); }
+    }
+
+    void begin() {}
+    PPL_INLINE void step(int idx) {
+        uint64_t h = head.load(memory_order_relaxed);
+        TraceEntry &e = ring[h & mask];
+        const Meta &m = meta[idx];
+        e.index = (uint32_t)idx;
+        e.line = m.line;
+        e.op = (uint16_t)m.op;
+        operand(m.a, e.ta, e.a);
+        operand(m.b, e.tb, e.b);
+        head.store(h + 1, memory_order_release);
+    }
+    void end(bool sentinel = false) {
+        if (sentinel) head.store(head.load(memory_order_relaxed) - 1, memory_order_release);
+    }
+
+    // Write the ring to path with plain system calls, so a signal handler may
+    // call it. False if the file could not be written.
+    bool dump() const {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        uint64_t h = head.load(memory_order_acquire);
+        uint64_t n = min<uint64_t>(h, ring.size());
+        char hdr[32];
+        memcpy(hdr, "PPLT", 4);
+        uint32_t count = (uint32_t)n;
+        memcpy(hdr + 4, &PPLT_VERSION, 4);
+        memcpy(hdr + 8, &engine, 4);
+        memcpy(hdr + 12, &program, 8);
+        memcpy(hdr + 20, &h, 8);
+        memcpy(hdr + 28, &count, 4);
+        bool ok = write_all(fd, hdr, sizeof hdr);
+        size_t first = (size_t)((h - n) & mask), run = min<size_t>((size_t)n, ring.size() - first);
+        ok = ok && write_all(fd, &ring[first], run * sizeof(TraceEntry));
+        ok = ok && write_all(fd, &ring[0], ((size_t)n - run) * sizeof(TraceEntry));
+        return close(fd) == 0 && ok;
+    }
+
+private:
+    static bool write_all(int fd, const void *p, size_t n) {
+        const char *c = static_cast<const char*>(p);
+        while (n) {
+            ssize_t w = write(fd, c, n);
+            if (w < 0) { if (errno == EINTR) continue; return false; }
+            c += w;
+            n -= (size_t)w;
+        }
+        return true;
+    }
+};
+
+#ifndef PPL_NO_MAIN
+// The run's trace for the signal handlers below
+static Trace *signal_trace = nullptr;
+
+// Fatal signals dump the trace, then take their default action
+static void on_trace_signal(int sig) {
+    if (signal_trace) signal_trace->dump();
+    if (sig == SIGUSR1) return; // on request: keep running
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+#endif
+
+// Dump the trace of a run that stopped with an error or a limit
+static void dump_trace(const Env &env, ostream &err) {
+    if (!env.trace) return;
+    uint64_t n = min<uint64_t>(env.trace->head.load(), env.trace->ring.size());
+    if (env.trace->dump()) err << "Trace of the last " << n << " steps in " << env.trace->path << endl;
+    else err << "Unable to write trace: " << env.trace->path << endl;
+}
+
+// Classic engine: one virtual execute() per step. Returns the number of
+// instructions executed; errors propagate as runtime_error.
+template <class Hook>
+static long long exec_classic_impl(const vector<Instruction*> &prog, Env &env, Hook *prof) {
+    long long steps = 0;
+    int pc = env.start_pc + 1; // 1-based
+    int lines = (int)prog.size();
+    Budget budget(env);
+    if (Hook::ON) prof->begin();
+    try {
+        while (pc >= 1) {
+            if (pc > lines) break; // fall off end => terminate
+            const Instruction* ins = prog[pc-1];
+            if (Hook::ON) prof->step(pc - 1);
+            int next = ins->execute(env, pc, prog);
+            ++steps;
+            if (next == -1) break; // HLT
+            if (next <= pc && budget.active && budget.due(steps)) budget.back_edge(next - 1, steps);
+            pc = next;
+        }
+    } catch (LimitExceeded &e) {
+        e.line = prog[pc - 1]->lineNo;
+        e.steps = steps;
+        throw;
+    } catch (const ListTooLong &e) {
+        throw runtime_error("Line " + to_string(prog[pc - 1]->lineNo) + ": " + e.what());
+    }
+    if (Hook::ON) prof->end();
+    return steps;
+}
+
+long long exec_classic(const vector<Instruction*> &prog, Env &env, Profile *prof = nullptr) {
+    if (prof) return exec_classic_impl(prog, env, prof);
+    if (env.trace) return exec_classic_impl(prog, env, env.trace);
+    return exec_classic_impl<NoHook>(prog, env, nullptr);
+}
+
+// How a run ended
+enum RunStatus { RUN_DONE, RUN_ERROR, RUN_LIMIT, RUN_SUSPENDED };
+
+// A limit stops the run but still dumps what the program had computed so
+// far. A suspended run only says where its snapshot went; its dump comes
+// from the resumed run.
+static RunStatus report_limit(const LimitExceeded &e, const Env &env, ostream &out, ostream &err, OutputFormat fmt) {
+    if (!e.suspended) {
+        err << "Limit exceeded: " << e.what() << " at line " << e.line << " after " << e.steps << " steps";
+        if (!e.snapshot.empty()) err << ", snapshot in " << e.snapshot;
+        err << endl;
+        print_env(env, out, fmt);
+        return RUN_LIMIT;
+    }
+    err << "Suspended at line " << e.line << " after " << e.steps << " steps, snapshot in " << e.snapshot << endl;
+    return RUN_SUSPENDED;
+}
+
+// Execute program. The program is only read, so several Envs may run it at
+// once; output goes to the given streams.
+RunStatus run_program(const vector<Instruction*> &prog, Env &env, Profile *prof = nullptr, ostream &out = cout, ostream &err = cerr,
+                      OutputFormat fmt = OUT_TEXT) {
+    try {
+        exec_classic(prog, env, prof);
+    } catch (const LimitExceeded &e) {
+        if (prof) prof->end();
+        RunStatus status = report_limit(e, env, out, err, fmt);
+        if (!e.suspended) dump_trace(env, err);
+        return status;
+    } catch (const runtime_error &e) {
+        if (prof) prof->end();
+        err << "Runtime error: " << e.what() << endl;
+        dump_trace(env, err);
+        return RUN_ERROR;
+    }
+    print_env(env, out, fmt);
+    return RUN_DONE;
+}
+
+// Counted integer loops found by accelerate_loops (-O2). The loop occupies
+// code [head, tail]: tail is the back edge (JMP head, or IF z head with z not
+// written in the loop), exactly one IF c X in between leaves it, and every
+// other instruction is an int ADD/SUB/CHS. The LOOP record that replaces
+// code[head] runs the whole loop on register copies of its identifiers.
+enum LoopOpKind { LOOP_ADD, LOOP_SUB, LOOP_CHS, LOOP_EXIT };
+
+struct LoopOp {
+    int kind;
+    int a, b; // register indices
+};
+
+struct LoopDesc {
+    int head, tail;
+    int exit_target;          // code index the exit IF jumps to
+    int back_slot;            // slot tested by the back edge, -1 for JMP
+    int bail;                 // code index of the displaced head record
+    int first_op, nops;       // range in Bytecode::loop_ops, in execution order
+    int first_slot, nslots;   // range in Bytecode::loop_slots: register -> Env slot
+    int linear;               // only ADD/SUB of loop-invariant registers: closed form applies
+    long long iter_steps;     // instructions per full iteration
+    long long exit_steps;     // instructions of the final partial iteration
+};
+
+// Bytecode engine: the program lowered into one contiguous array of records
+struct Bytecode {
+    vector<BInstr> code;      // program records, the HLT sentinel at index end, then LOOP bail stubs
+    int end;
+    vector<LoopDesc> loops;
+    vector<LoopOp> loop_ops;
+    vector<int> loop_slots;
+};
+
+static const int LOOP_MAX_REGS = 16;
+
+static void accelerate_loops(Bytecode &bc) {
+    vector<char> has_loop(bc.end, 0);
+    for (int t = 0; t < bc.end; ++t) {
+        const BInstr &back = bc.code[t];
+        if (!is_jump(back.op) || back.b < 0 || back.b > t) continue;
+        int h = back.b;
+        if (has_loop[h]) continue;
+
+        LoopDesc L;
+        L.head = h; L.tail = t;
+        L.back_slot = back.op == OP_IF ? back.a : -1;
+        int exit_pos = -1;
+        bool ok = true;
+        vector<int> slots;
+        vector<char> written;
+        auto reg = [&](int slot) {
+            for (size_t r = 0; r < slots.size(); ++r) if (slots[r] == slot) return (int)r;
+            slots.push_back(slot);
+            written.push_back(0);
+            return (int)slots.size() - 1;
+        };
+        vector<LoopOp> ops;
+        for (int i = h; i < t && ok; ++i) {
+            const BInstr &r = bc.code[i];
+            LoopOp op;
+            op.a = op.b = -1;
+            switch (r.op) {
+            case OP_ADD: case OP_SUB:
+                op.kind = r.op == OP_ADD ? LOOP_ADD : LOOP_SUB;
+                op.a = reg(r.a); op.b = reg(r.b);
+                written[op.a] = 1;
+                break;
+            case OP_CHS:
+                op.kind = LOOP_CHS;
+                op.a = reg(r.a);
+                written[op.a] = 1;
+                break;
+            case OP_IF:
+                if (exit_pos >= 0 || r.b < 0 || (r.b >= h && r.b <= t)) { ok = false; break; }
+                exit_pos = i;
+                op.kind = LOOP_EXIT;
+                op.a = reg(r.a);
+                L.exit_target = r.b;
+                break;
+            default:
+                ok = false;
+            }
+            if ((int)slots.size() > LOOP_MAX_REGS) ok = false; // stop scanning wide bodies early
+            if (ok) ops.push_back(op);
+        }
+        if (!ok || exit_pos < 0) continue;
+        if (L.back_slot >= 0) {
+            int r = reg(L.back_slot);
+            if (written[r] || (int)slots.size() > LOOP_MAX_REGS) continue;
+        }
+        L.linear = 1;
+        for (const LoopOp &op : ops) {
+            if (op.kind == LOOP_CHS) L.linear = 0;
+            if ((op.kind == LOOP_ADD || op.kind == LOOP_SUB) && written[op.b]) L.linear = 0;
+        }
+        L.iter_steps = t - h + 1;
+        L.exit_steps = exit_pos - h + 1;
+        L.first_op = (int)bc.loop_ops.size();
+        L.nops = (int)ops.size();
+        bc.loop_ops.insert(bc.loop_ops.end(), ops.begin(), ops.end());
+        L.first_slot = (int)bc.loop_slots.size();
+        L.nslots = (int)slots.size();
+        bc.loop_slots.insert(bc.loop_slots.end(), slots.begin(), slots.end());
+
+        // displaced head runs from a stub when the guard fails: head record, then JMP head+1
+        L.bail = (int)bc.code.size();
+        BInstr stub = bc.code[h], jmp = bc.code[h];
+        jmp.op = OP_JMP; jmp.a = -1; jmp.b = h + 1;
+        bc.code.push_back(stub);
+        bc.code.push_back(jmp);
+        BInstr &rec = bc.code[h];
+        rec.op = OP_LOOP;
+        rec.a = (int)bc.loops.size();
+        bc.loops.push_back(L);
+        has_loop[h] = 1;
+    }
+}
+
+Bytecode lower_program(const vector<Instruction*> &prog, int opt_level = 0) {
+    Bytecode bc;
+    bc.code.resize(prog.size() + 1);
+    bc.end = (int)prog.size();
+    for (size_t i = 0; i < prog.size(); ++i) {
+        BInstr &r = bc.code[i];
+        r.imm = 0; r.a = r.b = -1;
+        r.line = prog[i]->lineNo;
+        prog[i]->lower(r);
+        if (is_jump(r.op)) r.b = (r.imm >= 1 && r.imm <= (long long)prog.size()) ? (int)r.imm - 1 : -1;
+    }
+    // falling off the end behaves like HLT, so the loop needs no bounds check
+    BInstr &end = bc.code.back();
+    end.imm = 0; end.a = end.b = -1; end.line = (int)prog.size() + 1; end.op = OP_HLT;
+    if (opt_level >= 2) accelerate_loops(bc);
+    return bc;
+}
+
+// Static definedness and type analysis (-O1 and up, bytecode engine). A
+// forward dataflow pass over the IF/JMP/LOOP control flow tracks, per block
+// entry and slot, whether the slot may be undefined, an int, a list of ints
+// only, or a list that may hold lists. An
+// instruction whose checks hold on every state that reaches it is rewritten
+// to its _U variant; the checked record stays everywhere else. The pass runs
+// after loading, so .pplc files only ever hold checked records.
+enum {
+    S_UNDEF = 1, S_INT = 2, S_ILIST = 4, S_NLIST = 8,
+    S_LIST = S_ILIST | S_NLIST, S_DEF = S_INT | S_LIST, S_ANY = S_UNDEF | S_DEF
+};
+
+// What the head of a list in state m can be
+static unsigned char head_state(unsigned char m) {
+    return (unsigned char)((m & S_ILIST ? S_INT : 0) | (m & S_NLIST ? S_DEF : 0));
+}
+
+// Give up on programs whose block states would not fit in this many bytes
+static const size_t CHECK_STATE_BYTES = 64u << 20;
+
+struct FlowStep {
+    bool proven;      // every check passes on every incoming state
+    bool fails;       // some check fails on every incoming state
+    int fail_line;
+    const char *fail_op;
+    int fail_slot;
+    int fail_need, fail_have;
+};
+
+// Narrow st[slot] to the states in which the check "slot is in need" passes
+static void flow_need(FlowStep &fs, unsigned char *st, int slot, int need, int line, const char *op) {
+    if (fs.fails) return;
+    unsigned char have = st[slot];
+    if (!(have & need)) {
+        fs.fails = true;
+        fs.fail_line = line; fs.fail_op = op; fs.fail_slot = slot; fs.fail_need = need; fs.fail_have = have;
+        return;
+    }
+    if (have & ~need) fs.proven = false;
+    st[slot] = (unsigned char)(have & need);
+}
+
+// Apply one record to st along its non-failing path
+static FlowStep flow_step(const Bytecode &bc, const BInstr &r, unsigned char *st) {
+    FlowStep fs;
+    fs.proven = true; fs.fails = false;
+    const char *op = op_names[r.op];
+    switch (r.op) {
+    case OP_INTEGER: case OP_LIST:
+        flow_need(fs, st, r.a, S_UNDEF, r.line, op);
+        st[r.a] = r.op == OP_INTEGER ? S_INT : S_ILIST;
+        break;
+    case OP_MERGE: {
+        flow_need(fs, st, r.a, S_DEF, r.line, op);
+        flow_need(fs, st, r.b, S_LIST, r.line, op);
+        // prepending an int keeps an int-only list int-only
+        bool ilist = (st[r.a] & S_INT) && (st[r.b] & S_ILIST);
+        bool nlist = (st[r.a] & S_LIST) || (st[r.b] & S_NLIST);
+        st[r.b] = (unsigned char)((ilist ? S_ILIST : 0) | (nlist ? S_NLIST : 0));
+        break;
+    }
+    case OP_COPY: case OP_TAIL:
+        flow_need(fs, st, r.a, S_LIST, r.line, op);
+        st[r.b] = st[r.a];
+        break;
+    case OP_HEAD:
+        flow_need(fs, st, r.a, S_LIST, r.line, op);
+        st[r.b] = head_state(st[r.a]);
+        break;
+    case OP_LEN: case OP_SUM:
+        flow_need(fs, st, r.a, S_LIST, r.line, op);
+        st[r.b] = S_INT;
+        break;
+    case OP_RANGE:
+        flow_need(fs, st, r.a, S_INT, r.line, op);
+        st[r.b] = S_ILIST;
+        break;
+    case OP_FILL: {
+        flow_need(fs, st, r.a, S_DEF, r.line, op);
+        flow_need(fs, st, r.b, S_LIST, r.line, op);
+        unsigned char a = st[r.a];
+        st[r.b] = (unsigned char)((a & S_INT ? S_ILIST : 0) | (a & S_LIST ? S_NLIST : 0));
+        break;
+    }
+    case OP_REVERSE:
+        flow_need(fs, st, r.a, S_LIST, r.line, op);
+        break;
+    case OP_CONCAT: {
+        flow_need(fs, st, r.a, S_LIST, r.line, op);
+        flow_need(fs, st, r.b, S_LIST, r.line, op);
+        bool ilist = (st[r.a] & S_ILIST) && (st[r.b] & S_ILIST);
+        bool nlist = ((st[r.a] | st[r.b]) & S_NLIST) != 0;
+        st[r.b] = (unsigned char)((ilist ? S_ILIST : 0) | (nlist ? S_NLIST : 0));
+        break;
+    }
+    case OP_ASSIGN:
+        flow_need(fs, st, r.a, S_UNDEF | S_INT, r.line, op);
+        st[r.a] = S_INT;
+        break;
+    case OP_CHS:
+        flow_need(fs, st, r.a, S_INT, r.line, op);
+        break;
+    case OP_ADD:
+        flow_need(fs, st, r.a, S_INT, r.line, op);
+        flow_need(fs, st, r.b, S_INT, r.line, op);
+        break;
+    case OP_IF:
+        flow_need(fs, st, r.a, S_DEF, r.line, op);
+        if (r.b < 0) fs.proven = false; // the taken branch still fails
+        break;
+    case OP_SUB: // CHS b on this line, then ADD a b on the line in imm
+        flow_need(fs, st, r.b, S_INT, r.line, "CHS");
+        flow_need(fs, st, r.a, S_INT, (int)r.imm, "ADD");
+        break;
+    case OP_POP:
+        flow_need(fs, st, r.a, S_LIST, r.line, "HEAD");
+        st[r.b] = head_state(st[r.a]);
+        break;
+    case OP_LOOP:
+        // the exit edge is only taken once every loop slot held an int;
+        // callers narrow that edge themselves
+        fs.proven = false;
+        break;
+    default:
+        break;
+    }
+    return fs;
+}
+
+// Checked opcode -> proven variant, given the incoming state of its operand
+static int proven_op(const BInstr &r, unsigned char a_state, bool big_ints) {
+    switch (r.op) {
+    case OP_INTEGER: return OP_INTEGER_U;
+    case OP_LIST: return OP_LIST_U;
+    case OP_MERGE: return OP_MERGE_U;
+    case OP_COPY: return OP_COPY_U;
+    case OP_HEAD: return OP_HEAD_U;
+    case OP_TAIL: return OP_TAIL_U;
+    // the unchecked arithmetic assumes long longs, which a BigInt is not
+    case OP_ASSIGN: return big_ints ? r.op : OP_ASSIGN_U;
+    case OP_CHS: return big_ints ? r.op : OP_CHS_U;
+    case OP_ADD: return big_ints ? r.op : OP_ADD_U;
+    case OP_IF: return a_state == S_INT ? OP_IF_INT : !(a_state & ~S_LIST) ? OP_IF_LIST : OP_IF;
+    case OP_SUB: return big_ints ? r.op : OP_SUB_U;
+    case OP_POP: return OP_POP_U;
+    case OP_LEN: return OP_LEN_U;
+    default: return r.op;
+    }
+}
+
+// Rewrite proven records in place. seeded: slots may already be set when a
+// run starts (embedding API), so nothing is known at entry. resume: the run
+// starts at resume->start_pc with the slots resume holds (--resume). With
+// diags, also describe every reachable instruction that fails on all paths
+// into it. big_ints: the run uses --ints=big. Returns false if the program is
+// too large to analyze (nothing changed).
+static bool specialize_checks(Bytecode &bc, const SymbolTable &syms, bool seeded, vector<string> *diags = nullptr,
+                              const Env *resume = nullptr, bool big_ints = false) {
+    const int n = (int)bc.code.size();
+    const int nslots = syms.size();
+    const int entry = resume ? resume->start_pc : 0;
+    // blocks start at the entry, at every jump target and after every jump, LOOP or HLT
+    vector<char> leader(n + 1, 0);
+    leader[entry] = 1;
+    for (int i = 0; i < n; ++i) {
+        const BInstr &r = bc.code[i];
+        if (is_jump(r.op) && r.b >= 0) leader[r.b] = 1;
+        if (r.op == OP_LOOP) {
+            const LoopDesc &L = bc.loops[r.a];
+            leader[L.exit_target] = leader[L.bail] = 1;
+        }
+        if (is_jump(r.op) || r.op == OP_LOOP || r.op == OP_HLT) leader[i + 1] = 1;
+    }
+    vector<int> block_of(n, -1), start;
+    for (int i = 0; i < n; ++i) {
+        if (leader[i]) start.push_back(i);
+        block_of[i] = (int)start.size() - 1;
+    }
+    const int nblocks = (int)start.size();
+    if ((size_t)nblocks * (size_t)nslots > CHECK_STATE_BYTES) return false;
+    start.push_back(n);
+
+    vector<vector<unsigned char> > in(nblocks); // empty: not reached (yet)
+    vector<int> work;
+    vector<char> queued(nblocks, 0);
+    auto flow_into = [&](int target, const vector<unsigned char> &st) {
+        if (target < 0 || target >= n) return;
+        int b = block_of[target];
+        vector<unsigned char> &dst = in[b];
+        bool changed = false;
+        if (dst.empty()) { dst = st; changed = true; }
+        else for (int s = 0; s < nslots; ++s) {
+            unsigned char m = (unsigned char)(dst[s] | st[s]);
+            if (m != dst[s]) { dst[s] = m; changed = true; }
+        }
+        if (changed && !queued[b]) { queued[b] = 1; work.push_back(b); }
+    };
+    // Walk block b from its entry state; visit(i, state before i, step) sees every record
+    auto walk = [&](int b, const function<void(int, const unsigned char*, const FlowStep&)> &visit) {
+        vector<unsigned char> st = in[b], before;
+        for (int i = start[b]; i < start[b + 1]; ++i) {
+            const BInstr &r = bc.code[i];
+            if (visit) before = st;
+            FlowStep fs = flow_step(bc, r, st.data());
+            if (visit) visit(i, before.data(), fs);
+            if (fs.fails) return;
+            if (r.op == OP_HLT) return;
+            if (r.op == OP_JMP) { flow_into(r.b, st); return; }
+            if (r.op == OP_IF) { flow_into(r.b, st); continue; }
+            if (r.op == OP_LOOP) {
+                const LoopDesc &L = bc.loops[r.a];
+                flow_into(L.bail, st);
+                bool can_exit = true;
+                for (int k = 0; k < L.nslots; ++k) {
+                    unsigned char &m = st[bc.loop_slots[L.first_slot + k]];
+                    if (!(m & S_INT)) can_exit = false;
+                    m = S_INT;
+                }
+                if (can_exit) flow_into(L.exit_target, st);
+                return;
+            }
+        }
+        flow_into(start[b + 1], st);
+    };
+
+    const int first = block_of[entry];
+    in[first].assign(nslots, seeded ? S_ANY : S_UNDEF);
+    if (resume) {
+        for (int s = 0; s < nslots; ++s)
+            in[first][s] = !resume->exists(s) ? S_UNDEF : resume->get_const(s).is_int() ? S_INT : S_LIST;
+    }
+    work.push_back(first);
+    queued[first] = 1;
+    while (!work.empty()) {
+        int b = work.back();
+        work.pop_back();
+        queued[b] = 0;
+        walk(b, nullptr);
+    }
+
+    // States are final; rewrite against a frozen copy of the code
+    vector<int> new_op(n);
+    for (int i = 0; i < n; ++i) new_op[i] = bc.code[i].op;
+    vector<pair<int, string> > found;
+    for (int b = 0; b < nblocks; ++b) {
+        if (in[b].empty()) continue;
+        walk(b, [&](int i, const unsigned char *st, const FlowStep &fs) {
+            const BInstr &r = bc.code[i];
+            if (fs.proven && !fs.fails) new_op[i] = proven_op(r, r.a >= 0 ? st[r.a] : 0, big_ints);
+            if (fs.fails && diags) {
+                const char *what = fs.fail_need == S_UNDEF ? "already declared"
+                                 : fs.fail_have == S_UNDEF ? "undefined"
+                                 : fs.fail_need & S_LIST ? "never a list" : "never an int";
+                found.push_back(make_pair(fs.fail_line, "Line " + to_string(fs.fail_line) + ": " + fs.fail_op + ": " +
+                                          syms.names[fs.fail_slot] + " is " + what + " here"));
+            }
+        });
+    }
+    for (int i = 0; i < n; ++i) bc.code[i].op = new_op[i];
+    if (diags) {
+        sort(found.begin(), found.end());
+        found.erase(unique(found.begin(), found.end()), found.end());
+        for (auto &f : found) diags->push_back(f.second);
+    }
+    return true;
+}
+
+// Inverse of an odd number modulo 2^64 (Newton iteration)
+static unsigned long long inverse_mod_2_64(unsigned long long d) {
+    unsigned long long x = d;
+    for (int i = 0; i < 5; ++i) x *= 2 - d * x;
+    return x;
+}
+
+// Run an accelerated loop. Arithmetic wraps modulo 2^64 like the plain ADD
+// does in practice. When every update is "v += invariant" the exit iteration
+// is solved directly: s + k*d == 0 (mod 2^64) for the exit register. Other
+// bodies iterate natively on the registers. Returns the number of PPL
+// instructions the loop stands for, or -1 to bail out to the interpreter
+// (an operand is undefined or not an int, the back edge would not be taken,
+// or a linear loop never reaches its exit). At most max_iters full iterations
+// run, and at most max_native_iters when they are iterated one by one; if
+// the exit is not reached by then, the registers are stored as of the loop
+// head and exited is false.
+static long long run_loop(const Bytecode &bc, const LoopDesc &L, Value *F, const char *D,
+                          unsigned long long max_iters, unsigned long long max_native_iters, bool &exited) {
+    if (max_iters == 0) return -1; // not even one iteration left: let the interpreter stop it
+    unsigned long long reg[LOOP_MAX_REGS];
+    const int *slots = &bc.loop_slots[L.first_slot];
+    for (int r = 0; r < L.nslots; ++r) {
+        if (!D[slots[r]] || F[slots[r]].type != VT_INT) return -1;
+        reg[r] = (unsigned long long)F[slots[r]].ival;
+    }
+    if (L.back_slot >= 0 && F[L.back_slot].ival != 0) return -1;
+    const LoopOp *ops = &bc.loop_ops[L.first_op];
+    const LoopOp *ops_end = ops + L.nops;
+    unsigned long long k = 0; // full iterations before the exit is taken
+    exited = true;
+
+    if (L.linear) {
+        unsigned long long pre[LOOP_MAX_REGS] = {0}, post[LOOP_MAX_REGS] = {0};
+        unsigned long long *acc = pre;
+        int exit_reg = -1;
+        for (const LoopOp *op = ops; op != ops_end; ++op) {
+            if (op->kind == LOOP_EXIT) { exit_reg = op->a; acc = post; }
+            else if (op->kind == LOOP_ADD) acc[op->a] += reg[op->b];
+            else acc[op->a] -= reg[op->b];
+        }
+        unsigned long long s = reg[exit_reg] + pre[exit_reg];
+        unsigned long long d = pre[exit_reg] + post[exit_reg];
+        if (s != 0) {
+            if (d == 0) return -1;
+            int tz = __builtin_ctzll(d);
+            if (s & ((1ULL << tz) - 1)) return -1;
+            k = ((0 - s) >> tz) * inverse_mod_2_64(d >> tz);
+            if (tz) k &= (~0ULL) >> tz;
+        }
+        if (k >= max_iters && max_iters != ULLONG_MAX) {
+            k = max_iters;
+            exited = false;
+            for (int r = 0; r < L.nslots; ++r) reg[r] += k * (pre[r] + post[r]);
+        } else {
+            for (int r = 0; r < L.nslots; ++r) reg[r] += (k + 1) * pre[r] + k * post[r];
+        }
+    } else {
+        for (;;) {
+            for (const LoopOp *op = ops; op != ops_end; ++op) {
+                switch (op->kind) {
+                case LOOP_ADD: reg[op->a] += reg[op->b]; break;
+                case LOOP_SUB: reg[op->a] -= reg[op->b]; break;
+                case LOOP_CHS: reg[op->a] = 0 - reg[op->a]; break;
+                default:
+                    if (reg[op->a] == 0) goto done;
+                }
+            }
+            if (++k == max_iters || k == max_native_iters) { exited = false; break; }
+        }
+    done:;
+    }
+    for (int r = 0; r < L.nslots; ++r) F[slots[r]].ival = (long long)reg[r];
+    // a closed-form k can be near 2^64; saturate so the step counter cannot wrap
+    const unsigned long long cap = (unsigned long long)LLONG_MAX / 4;
+    if (k >= cap / (unsigned long long)L.iter_steps) return (long long)cap;
+    return (long long)(k * L.iter_steps + (exited ? L.exit_steps : 0));
+}
+
+// Error paths are kept out of line so the dispatch loop stays small. The
+// bytecode engine records its errors with run_error and returns; the native
+// runtime, whose callers unwind through generated code, throws.
+static void run_error(Env &env, long long line, const char *what, int slot, long long number = 0, bool has_number = false) PPL_SLOW;
+static void run_error(Env &env, long long line, const char *what, int slot, long long number, bool has_number) {
+    RunError &e = env.error;
+    e.line = line; e.what = what; e.slot = slot; e.number = number; e.has_number = has_number;
+}
+static void bc_fail_at(long long line, const string &msg) PPL_COLD;
+static void bc_fail_at(long long line, const string &msg) {
+    throw runtime_error("Line " + to_string(line) + ": " + msg);
+}
+
+// Returns the number of instructions executed (the end sentinel not counted),
+// or -1 after a failed check, with env.error saying which. Hook: NoHook,
+// Profile or Trace. BIG: env.big_ints. Both are fixed per instantiation, so a
+// plain wrapping run pays nothing for either.
+template <class Hook, bool BIG>
+static long long exec_bytecode_impl(const Bytecode &bc, Env &env, Hook *prof) {
+    long long steps = 0;
+    Value *F = env.frame.data();
+    char *D = env.defined.data();
+    const bool persistent = env.persistent_lists;
+    const BInstr *code = bc.code.data();
+    const BInstr *ip = code + env.start_pc;
+    Budget budget(env);
+    // with a timeout, iterated loops hand back control this often
+    const unsigned long long native_iters = env.limits.timeout > 0 ? 1u << 20 : ULLONG_MAX;
+    if (Hook::ON) prof->begin();
+
+    try {
+    // Handlers keep no locals with destructors: a computed goto out of a block
+    // skips them, which would leak list references. Temporaries die per statement.
+#if defined(__GNUC__) && !defined(PPL_NO_COMPUTED_GOTO)
+    // Token-threaded dispatch: one indirect jump per handler, better predicted than a shared switch
+    static void *const labels[OP_COUNT] = {
+        &&L_NOP, &&L_INTEGER, &&L_LIST, &&L_MERGE, &&L_COPY, &&L_HEAD, &&L_TAIL,
+        &&L_ASSIGN, &&L_CHS, &&L_ADD, &&L_IF, &&L_HLT, &&L_LEN,
+        &&L_SUM, &&L_RANGE, &&L_FILL, &&L_REVERSE, &&L_CONCAT,
+        &&L_SUB, &&L_JMP, &&L_POP,
+        &&L_LOOP,
+        &&L_INTEGER_U, &&L_LIST_U, &&L_MERGE_U, &&L_COPY_U, &&L_HEAD_U, &&L_TAIL_U,
+        &&L_ASSIGN_U, &&L_CHS_U, &&L_ADD_U, &&L_IF_INT, &&L_IF_LIST, &&L_SUB_U, &&L_POP_U, &&L_LEN_U
+    };
+#define DISPATCH() do { ++steps; if (Hook::ON) prof->step((int)(ip - code)); goto *labels[ip->op]; } while (0)
+#define CASE(OP) L_##OP
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+#define FAIL_AT(LINE, WHAT, SLOT) do { run_error(env, LINE, WHAT, SLOT); goto fail; } while (0)
+#define FAIL(WHAT, SLOT) FAIL_AT(ip->line, WHAT, SLOT)
+    DISPATCH();
+#else
+#define DISPATCH() goto dispatch
+#define CASE(OP) case OP_##OP
+#define NEXT() do { ++ip; goto dispatch; } while (0)
+#define FAIL_AT(LINE, WHAT, SLOT) do { run_error(env, LINE, WHAT, SLOT); goto fail; } while (0)
+#define FAIL(WHAT, SLOT) FAIL_AT(ip->line, WHAT, SLOT)
+dispatch:
+    ++steps;
+    if (Hook::ON) prof->step((int)(ip - code));
+    switch (ip->op) {
+#endif
+    CASE(NOP):
+        NEXT();
+    CASE(INTEGER):
+        if (D[ip->a]) FAIL("Identifier already declared: ", ip->a);
+        F[ip->a] = Value::make_int(0); D[ip->a] = 1;
+        NEXT();
+    CASE(LIST):
+        if (D[ip->a]) FAIL("Identifier already declared: ", ip->a);
+        F[ip->a] = Value::make_list(nullptr); D[ip->a] = 1;
+        NEXT();
+    CASE(MERGE): {
+        if (!D[ip->a]) FAIL("Undefined identifier: ", ip->a);
+        if (!D[ip->b]) FAIL("Undefined list identifier: ", ip->b);
+        Value &target = F[ip->b];
+        if (target.type != VT_LIST) FAIL("MERGE target is not a list: ", ip->b);
+        // the inserted copy is taken before target changes (MERGE A A)
+        env.arena.push_front(target, value_copy(F[ip->a], persistent));
+        NEXT();
+    }
+    CASE(COPY): {
+        if (!D[ip->a]) FAIL("Undefined source: ", ip->a);
+        const Value &v = F[ip->a];
+        if (v.type != VT_LIST) FAIL("COPY source is not a list: ", ip->a);
+        if (ip->b != ip->a) F[ip->b] = value_copy(v, persistent);
+        D[ip->b] = 1;
+        NEXT();
+    }
+    CASE(HEAD): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        const Value &lv = F[ip->a];
+        if (lv.type != VT_LIST) FAIL("HEAD target not a list: ", ip->a);
+        if (!lv.lref) FAIL("HEAD on empty list: ", ip->a);
+        F[ip->b] = value_copy(list_first(lv.lref), persistent); D[ip->b] = 1;
+        NEXT();
+    }
+    CASE(TAIL): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        const Value &sv = F[ip->a];
+        if (sv.type != VT_LIST) FAIL("TAIL source not a list: ", ip->a);
+        if (ip->b == ip->a) list_drop_front(F[ip->a], persistent);
+        else F[ip->b] = Value::make_list(list_tail(sv.lref, persistent));
+        D[ip->b] = 1;
+        NEXT();
+    }
+    CASE(LEN): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        const Value &lv = F[ip->a];
+        if (lv.type != VT_LIST) FAIL("LEN target not a list: ", ip->a);
+        F[ip->b] = Value::make_int((long long)list_length(lv.lref)); D[ip->b] = 1;
+        NEXT();
+    }
+    CASE(SUM): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        const Value &lv = F[ip->a];
+        if (lv.type != VT_LIST) FAIL("SUM target not a list: ", ip->a);
+        Value sum;
+        if (!list_sum(lv.lref, sum, BIG, env.arena)) FAIL("SUM element not an int: ", ip->a);
+        F[ip->b] = move(sum); D[ip->b] = 1;
+        NEXT();
+    }
+    CASE(RANGE): {
+        if (!D[ip->a]) FAIL("Undefined identifier: ", ip->a);
+        const Value &n = F[ip->a];
+        if (!n.is_int()) FAIL("RANGE count not an int: ", ip->a);
+        if (n.type == VT_BIG ? n.big->neg : n.ival < 0) FAIL("RANGE count is negative: ", ip->a);
+        if (n.type == VT_BIG || n.ival > UINT_MAX) FAIL("RANGE count too large: ", ip->a);
+        F[ip->b] = Value::make_list(list_range(env.arena, (size_t)n.ival)); D[ip->b] = 1;
+        NEXT();
+    }
+    CASE(FILL): {
+        if (!D[ip->a]) FAIL("Undefined identifier: ", ip->a);
+        if (!D[ip->b]) FAIL("Undefined list identifier: ", ip->b);
+        Value &target = F[ip->b];
+        if (target.type != VT_LIST) FAIL("FILL target is not a list: ", ip->b);
+        target = Value::make_list(list_fill(env.arena, F[ip->a], list_length(target.lref), persistent));
+        NEXT();
+    }
+    CASE(REVERSE): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        Value &lv = F[ip->a];
+        if (lv.type != VT_LIST) FAIL("REVERSE target not a list: ", ip->a);
+        lv = Value::make_list(list_reverse(env.arena, lv.lref, persistent));
+        NEXT();
+    }
+    CASE(CONCAT): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        if (!D[ip->b]) FAIL("Undefined list identifier: ", ip->b);
+        Value &target = F[ip->b];
+        if (F[ip->a].type != VT_LIST) FAIL("CONCAT source is not a list: ", ip->a);
+        if (target.type != VT_LIST) FAIL("CONCAT target is not a list: ", ip->b);
+        target = Value::make_list(list_concat(env.arena, F[ip->a].lref, ListPtr(target.lref), persistent));
+        NEXT();
+    }
+    CASE(ASSIGN):
+        if (D[ip->a]) {
+            if (!F[ip->a].is_int()) FAIL("ASSIGN to non-int: ", ip->a);
+            if (F[ip->a].type == VT_BIG) F[ip->a] = Value();
+            F[ip->a].ival = ip->imm;
+        } else {
+            F[ip->a] = Value::make_int(ip->imm); D[ip->a] = 1;
+        }
+        NEXT();
+    CASE(CHS):
+        if (!D[ip->a]) FAIL("CHS undefined id: ", ip->a);
+        if (!F[ip->a].is_int()) FAIL("CHS on non-int: ", ip->a);
+        int_neg(F[ip->a], BIG, env.arena);
+        NEXT();
+    CASE(ADD):
+        if (!D[ip->a]) FAIL("ADD undefined id: ", ip->a);
+        if (!D[ip->b]) FAIL("ADD undefined id: ", ip->b);
+        if (!F[ip->a].is_int() || !F[ip->b].is_int()) FAIL("ADD type error", -1);
+        int_add(F[ip->a], F[ip->b], BIG, env.arena);
+        NEXT();
+    CASE(IF): {
+        if (!D[ip->a]) FAIL("IF undefined id: ", ip->a);
+        const Value &v = F[ip->a];
+        bool cond = v.type == VT_INT ? v.ival == 0 : v.lref == 0; // a big's pointer is never 0 either
+        if (!cond) NEXT();
+        if (ip->b < 0) { run_error(env, ip->line, "IF jump out of range: ", -1, ip->imm, true); goto fail; }
+        if (budget.active && ip->b <= ip - code && budget.due(steps)) budget.back_edge(ip->b, steps);
+        ip = code + ip->b;
+        DISPATCH();
+    }
+    CASE(SUB):
+        if (!D[ip->b]) FAIL("CHS undefined id: ", ip->b);
+        if (!F[ip->b].is_int()) FAIL("CHS on non-int: ", ip->b);
+        if (!D[ip->a]) FAIL_AT(ip->imm, "ADD undefined id: ", ip->a);
+        if (!F[ip->a].is_int()) FAIL_AT(ip->imm, "ADD type error", -1);
+        int_sub(F[ip->a], F[ip->b], BIG, env.arena);
+        NEXT();
+    CASE(JMP):
+        if (budget.active && ip->b <= ip - code && budget.due(steps)) budget.back_edge(ip->b, steps);
+        ip = code + ip->b;
+        DISPATCH();
+    CASE(POP): {
+        if (!D[ip->a]) FAIL("Undefined list: ", ip->a);
+        Value &lv = F[ip->a];
+        if (lv.type != VT_LIST) FAIL("HEAD target not a list: ", ip->a);
+        if (!lv.lref) FAIL("HEAD on empty list: ", ip->a);
+        F[ip->b] = value_copy(list_first(lv.lref), persistent); D[ip->b] = 1;
+        list_drop_front(lv, persistent);
+        NEXT();
+    }
+    CASE(LOOP): {
+        const LoopDesc &L = bc.loops[ip->a];
+        bool exited;
+        // native registers wrap, so --ints=big always takes the interpreted body
+        long long n = BIG ? -1 : run_loop(bc, L, F, D, budget.loop_iterations(steps, L.iter_steps), native_iters, exited);
+        if (n < 0) {
+            steps -= 2; // neither LOOP nor the stub's JMP is a PPL instruction
+            ip = code + L.bail;
+        } else {
+            // a loop cut short resumes at its head: a back edge like any other
+            steps += n - 1;
+            if (exited) ip = code + L.exit_target;
+            if (budget.active && budget.due(steps, true)) budget.back_edge((int)(ip - code), steps);
+        }
+        DISPATCH();
+    }
+    // Proven variants: every definedness and type check is known to pass
+    CASE(INTEGER_U):
+        F[ip->a] = Value::make_int(0); D[ip->a] = 1;
+        NEXT();
+    CASE(LIST_U):
+        F[ip->a] = Value::make_list(nullptr); D[ip->a] = 1;
+        NEXT();
+    CASE(MERGE_U):
+        env.arena.push_front(F[ip->b], value_copy(F[ip->a], persistent));
+        NEXT();
+    CASE(COPY_U):
+        if (ip->b != ip->a) F[ip->b] = value_copy(F[ip->a], persistent);
+        D[ip->b] = 1;
+        NEXT();
+    CASE(HEAD_U):
+        if (!F[ip->a].lref) FAIL("HEAD on empty list: ", ip->a);
+        F[ip->b] = value_copy(list_first(F[ip->a].lref), persistent); D[ip->b] = 1;
+        NEXT();
+    CASE(TAIL_U):
+        if (ip->b == ip->a) list_drop_front(F[ip->a], persistent);
+        else F[ip->b] = Value::make_list(list_tail(F[ip->a].lref, persistent));
+        D[ip->b] = 1;
+        NEXT();
+    CASE(ASSIGN_U):
+        // an undefined slot always holds an int (see Env::reset)
+        F[ip->a].ival = ip->imm; D[ip->a] = 1;
+        NEXT();
+    CASE(CHS_U):
+        F[ip->a].ival = wrap_neg(F[ip->a].ival);
+        NEXT();
+    CASE(ADD_U):
+        F[ip->a].ival = wrap_add(F[ip->a].ival, F[ip->b].ival);
+        NEXT();
+    CASE(IF_INT):
+        if (F[ip->a].ival != 0) NEXT(); // also taken for a big: its pointer is never null
+        if (budget.active && ip->b <= ip - code && budget.due(steps)) budget.back_edge(ip->b, steps);
+        ip = code + ip->b;
+        DISPATCH();
+    CASE(IF_LIST):
+        if (F[ip->a].lref != 0) NEXT();
+        if (budget.active && ip->b <= ip - code && budget.due(steps)) budget.back_edge(ip->b, steps);
+        ip = code + ip->b;
+        DISPATCH();
+    CASE(SUB_U):
+        F[ip->a].ival = wrap_sub(F[ip->a].ival, F[ip->b].ival);
+        NEXT();
+    CASE(POP_U): {
+        Value &lv = F[ip->a];
+        if (!lv.lref) FAIL("HEAD on empty list: ", ip->a);
+        F[ip->b] = value_copy(list_first(lv.lref), persistent); D[ip->b] = 1;
+        list_drop_front(lv, persistent);
+        NEXT();
+    }
+    CASE(LEN_U):
+        F[ip->b] = Value::make_int((long long)list_length(F[ip->a].lref)); D[ip->b] = 1;
+        NEXT();
+    CASE(HLT):
+        if (Hook::ON) prof->end(ip == code + bc.end);
+        return ip == code + bc.end ? steps - 1 : steps;
+#if !(defined(__GNUC__) && !defined(PPL_NO_COMPUTED_GOTO))
+    }
+#endif
+    } catch (LimitExceeded &e) {
+        e.line = ip->line;
+        e.steps = steps;
+        throw;
+    } catch (const ListTooLong &e) {
+        run_error(env, ip->line, "List too long: ", -1, (long long)e.length, true);
+        goto fail;
+    }
+fail:
+    if (Hook::ON) prof->end();
+    return -1;
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+#undef FAIL_AT
+#undef FAIL
+}
+
+template <bool BIG>
+static long long exec_bytecode_as(const Bytecode &bc, Env &env, Profile *prof) {
+    if (prof) return exec_bytecode_impl<Profile, BIG>(bc, env, prof);
+    if (env.trace) return exec_bytecode_impl<Trace, BIG>(bc, env, env.trace);
+    return exec_bytecode_impl<NoHook, BIG>(bc, env, nullptr);
+}
+
+// Steps executed, or -1 with env.error set
+static long long try_bytecode(const Bytecode &bc, Env &env, Profile *prof = nullptr) {
+    return env.big_ints ? exec_bytecode_as<true>(bc, env, prof) : exec_bytecode_as<false>(bc, env, prof);
+}
+
+// Execute program on the bytecode engine; same output contract as run_program
+RunStatus run_bytecode(const Bytecode &bc, Env &env, Profile *prof = nullptr, ostream &out = cout, ostream &err = cerr,
+                       OutputFormat fmt = OUT_TEXT) {
+    long long steps;
+    try {
+        steps = try_bytecode(bc, env, prof);
+    } catch (const LimitExceeded &e) {
+        if (prof) prof->end();
+        RunStatus status = report_limit(e, env, out, err, fmt);
+        if (!e.suspended) dump_trace(env, err);
+        return status;
+    }
+    if (steps < 0) {
+        err << "Runtime error: " << env.error_message() << endl;
+        dump_trace(env, err);
+        return RUN_ERROR;
+    }
+    print_env(env, out, fmt);
+    return RUN_DONE;
+}
+
+// Compiled programs (.pplc): the lowered, optimized bytecode and the symbol
+// table, written as fixed-size records so loading is a bounds check and a
+// few bulk copies instead of a parse. Layout, each section padded to 8 bytes:
+//   CompiledHeader | BInstr[ncode] | LoopDesc[nloops] | LoopOp[nloop_ops]
+//   | int[nloop_slots] | uint32 name length[nsyms] | name bytes
+// Records are stored in host layout; the header pins byte order and record
+// sizes so a file from a different build is rejected rather than misread.
+static const char PPLC_MAGIC[4] = {'P', 'P', 'L', 'C'};
+static const uint32_t PPLC_VERSION = 3;
+
+struct CompiledHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;    // 0x01020304 as written
+    uint32_t opt_level;
+    uint32_t rec_sizes[4];  // sizeof BInstr, LoopDesc, LoopOp, int
+    uint64_t source_hash;   // fnv1a of the source text, for the cache
+    uint64_t source_size;
+    uint32_t nsyms, ncode, end, nloops, nloop_ops, nloop_slots;
+    uint64_t names_bytes;
+};
+
+static void fill_rec_sizes(uint32_t *r) {
+    r[0] = sizeof(BInstr); r[1] = sizeof(LoopDesc); r[2] = sizeof(LoopOp); r[3] = sizeof(int);
+}
+
+static bool is_compiled(const char *data, size_t size) {
+    return size >= sizeof PPLC_MAGIC && memcmp(data, PPLC_MAGIC, sizeof PPLC_MAGIC) == 0;
+}
+
+// Write bc and syms to path. Goes through a temporary file and rename so a
+// reader (or a concurrent cache fill) never sees a partial file.
+void write_compiled(const string &path, const Bytecode &bc, const SymbolTable &syms, int opt_level,
+                    unsigned long long source_hash, size_t source_size) {
+    CompiledHeader h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, PPLC_MAGIC, sizeof h.magic);
+    h.version = PPLC_VERSION;
+    h.byte_order = 0x01020304;
+    h.opt_level = (uint32_t)opt_level;
+    fill_rec_sizes(h.rec_sizes);
+    h.source_hash = source_hash;
+    h.source_size = source_size;
+    h.nsyms = (uint32_t)syms.size();
+    h.ncode = (uint32_t)bc.code.size();
+    h.end = (uint32_t)bc.end;
+    h.nloops = (uint32_t)bc.loops.size();
+    h.nloop_ops = (uint32_t)bc.loop_ops.size();
+    h.nloop_slots = (uint32_t)bc.loop_slots.size();
+    vector<uint32_t> lens(syms.size());
+    for (int i = 0; i < syms.size(); ++i) {
+        lens[i] = (uint32_t)syms.names[i].size();
+        h.names_bytes += lens[i];
+    }
+
+    string tmp = path + ".tmp" + to_string((long)getpid());
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) throw runtime_error("Unable to write file: " + path);
+    static const char zeros[8] = {0};
+    bool ok = true;
+    auto put = [&](const void *p, size_t n) {
+        if (ok && n && fwrite(p, 1, n, f) != n) ok = false;
+        if (ok && n % 8 && fwrite(zeros, 1, 8 - n % 8, f) != 8 - n % 8) ok = false;
+    };
+    put(&h, sizeof h);
+    put(bc.code.data(), bc.code.size() * sizeof(BInstr));
+    put(bc.loops.data(), bc.loops.size() * sizeof(LoopDesc));
+    put(bc.loop_ops.data(), bc.loop_ops.size() * sizeof(LoopOp));
+    put(bc.loop_slots.data(), bc.loop_slots.size() * sizeof(int));
+    put(lens.data(), lens.size() * sizeof(uint32_t));
+    for (const string &name : syms.names)
+        if (ok && !name.empty() && fwrite(name.data(), 1, name.size(), f) != name.size()) ok = false;
+    if (ok && h.names_bytes % 8 && fwrite(zeros, 1, 8 - h.names_bytes % 8, f) != 8 - h.names_bytes % 8) ok = false;
+    if (fclose(f) != 0) ok = false;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        throw runtime_error("Unable to write file: " + path);
+    }
+}
+
+// Every index the engines trust without checking must be in range
+static void check_compiled(const Bytecode &bc, int nsyms) {
+    auto bad = [](const char *what) { throw runtime_error(string("invalid compiled program: bad ") + what); };
+    const int ncode = (int)bc.code.size();
+    if (bc.end < 0 || bc.end >= ncode || bc.code[bc.end].op != OP_HLT) bad("end sentinel");
+    auto slot = [&](int s) { if (s < 0 || s >= nsyms) bad("slot"); };
+    for (const BInstr &r : bc.code) {
+        switch (r.op) {
+        case OP_MERGE: case OP_COPY: case OP_HEAD: case OP_TAIL: case OP_ADD: case OP_SUB: case OP_POP: case OP_LEN:
+        case OP_SUM: case OP_RANGE: case OP_FILL: case OP_CONCAT:
+            slot(r.b);
+            // fall through
+        case OP_INTEGER: case OP_LIST: case OP_ASSIGN: case OP_CHS: case OP_REVERSE:
+            slot(r.a);
+            break;
+        case OP_IF:
+            slot(r.a);
+            // fall through
+        case OP_JMP:
+            if (r.b < -1 || r.b >= ncode) bad("jump target");
+            break;
+        case OP_LOOP:
+            if (r.a < 0 || r.a >= (int)bc.loops.size()) bad("loop");
+            break;
+        case OP_NOP: case OP_HLT:
+            break;
+        default:
+            bad("opcode");
+        }
+    }
+    for (const LoopDesc &L : bc.loops) {
+        if (L.head < 0 || L.head >= ncode || L.exit_target < 0 || L.exit_target >= ncode || L.bail < 0 || L.bail >= ncode)
+            bad("loop");
+        if (L.back_slot != -1) slot(L.back_slot);
+        if (L.exit_steps < 1 || L.exit_steps > L.iter_steps) bad("loop");
+        if (L.first_op < 0 || L.nops < 0 || L.nops > (int)bc.loop_ops.size() - L.first_op) bad("loop");
+        if (L.first_slot < 0 || L.nslots < 0 || L.nslots > LOOP_MAX_REGS || L.nslots > (int)bc.loop_slots.size() - L.first_slot)
+            bad("loop");
+        int exits = 0;
+        for (int i = 0; i < L.nops; ++i) {
+            const LoopOp &op = bc.loop_ops[L.first_op + i];
+            if (op.kind < LOOP_ADD || op.kind > LOOP_EXIT || op.a < 0 || op.a >= L.nslots) bad("loop op");
+            if ((op.kind == LOOP_ADD || op.kind == LOOP_SUB) && (op.b < 0 || op.b >= L.nslots)) bad("loop op");
+            if (op.kind == LOOP_EXIT) ++exits;
+        }
+        if (exits != 1) bad("loop op");
+    }
+    for (int s : bc.loop_slots) slot(s);
+}
+
+// Load a compiled program image into bc and syms. Copies each section in
+// bulk; nothing is allocated per instruction.
+void read_compiled(const char *data, size_t size, Bytecode &bc, SymbolTable &syms, CompiledHeader *info = nullptr) {
+    size_t pos = 0;
+    auto take = [&](uint64_t n) -> const char* {
+        uint64_t padded = (n + 7) & ~(uint64_t)7;
+        if (padded > size - pos) throw runtime_error("invalid compiled program: truncated");
+        const char *p = data + pos;
+        pos += (size_t)padded;
+        return p;
+    };
+    CompiledHeader h;
+    memcpy(&h, take(sizeof h), sizeof h);
+    uint32_t sizes[4];
+    fill_rec_sizes(sizes);
+    if (memcmp(h.magic, PPLC_MAGIC, sizeof h.magic) != 0) throw runtime_error("invalid compiled program: bad magic");
+    if (h.version != PPLC_VERSION) throw runtime_error("unsupported compiled program version " + to_string(h.version));
+    if (h.byte_order != 0x01020304 || memcmp(h.rec_sizes, sizes, sizeof sizes) != 0)
+        throw runtime_error("compiled program was built for a different platform");
+    if (h.ncode == 0 || h.nsyms > (uint32_t)INT32_MAX) throw runtime_error("invalid compiled program: bad header");
+
+    const char *p = take((uint64_t)h.ncode * sizeof(BInstr));
+    bc.code.resize(h.ncode);
+    memcpy(bc.code.data(), p, (size_t)h.ncode * sizeof(BInstr));
+    bc.end = (int)h.end;
+    p = take((uint64_t)h.nloops * sizeof(LoopDesc));
+    bc.loops.resize(h.nloops);
+    if (h.nloops) memcpy(bc.loops.data(), p, (size_t)h.nloops * sizeof(LoopDesc));
+    p = take((uint64_t)h.nloop_ops * sizeof(LoopOp));
+    bc.loop_ops.resize(h.nloop_ops);
+    if (h.nloop_ops) memcpy(bc.loop_ops.data(), p, (size_t)h.nloop_ops * sizeof(LoopOp));
+    p = take((uint64_t)h.nloop_slots * sizeof(int));
+    bc.loop_slots.resize(h.nloop_slots);
+    if (h.nloop_slots) memcpy(bc.loop_slots.data(), p, (size_t)h.nloop_slots * sizeof(int));
+
+    const char *lens = take((uint64_t)h.nsyms * sizeof(uint32_t));
+    const char *names = take(h.names_bytes);
+    uint64_t off = 0;
+    for (uint32_t i = 0; i < h.nsyms; ++i) {
+        uint32_t n;
+        memcpy(&n, lens + i * sizeof(uint32_t), sizeof n);
+        if (n > h.names_bytes - off) throw runtime_error("invalid compiled program: bad symbol table");
+        if (syms.intern(names + off, n) != (int)i) throw runtime_error("invalid compiled program: duplicate symbol");
+        off += n;
+    }
+    check_compiled(bc, syms.size());
+    if (info) *info = h;
+}
+
+// Cache location for --cache without a directory
+static string default_cache_dir() {
+    if (const char *d = getenv("PPL_CACHE_DIR")) if (*d) return d;
+    if (const char *d = getenv("XDG_CACHE_HOME")) if (*d) return string(d) + "/ppl";
+    if (const char *d = getenv("HOME")) if (*d) return string(d) + "/.cache/ppl";
+    return "";
+}
+
+// mkdir -p; failures surface later when the cache file cannot be written
+static void make_dirs(const string &dir) {
+    for (size_t i = 1; i <= dir.size(); ++i)
+        if (i == dir.size() || dir[i] == '/') mkdir(dir.substr(0, i).c_str(), 0755);
+}
+
+// Command-line options
+struct Options {
+    string file;
+    bool classic = false;      // --engine=classic
+    bool persistent = true;    // --lists=persistent|copy|hashcons
+    bool hashcons = false;     // --lists=hashcons: persistent, and equal lists share one chain
+    bool big_ints = false;     // --ints=wrap|big
+    bool arena_stats = false;  // --arena-stats
+    int bench_runs = 0;        // --bench N
+    bool profile = false;      // --profile
+    int opt_level = 2;         // -O0 none, -O1 optimize_program, -O2 also loop acceleration
+    bool compile = false;      // --compile: write a .pplc instead of running
+    bool emit_cpp = false;     // --emit-cpp: write the program as C++ instead of running
+    string output;             // -o FILE for --compile (default: input name + "c") or --emit-cpp (+ ".cpp")
+    bool cache = false;        // --cache[=DIR]: reuse compiled programs keyed on the source text
+    string cache_dir;
+    string batch;              // --batch FILE: run every program listed in FILE
+    int jobs = 0;              // -j N worker threads for --batch (0 = one per hardware thread)
+    bool serve = false;        // --serve: answer requests on stdin until EOF or quit
+    OutputFormat format = OUT_TEXT; // --output=text|json|binary
+    bool check = false;        // --check: report instructions that fail on every path, don't run
+    bool seeded = false;       // slots may be set before a run (embedding API)
+    RunLimits limits;          // --max-steps=N --max-memory=SIZE --timeout=SECONDS
+    string snapshot;           // --snapshot FILE: save the state here when stopped (and periodically)
+    double snapshot_every = 0; // --snapshot-every=SECONDS: background checkpoint interval
+    string resume;             // --resume FILE: continue from a snapshot
+    int trace = 0;             // --trace=N: keep the last N steps, dumped on an error or a signal
+    string trace_file = "ppl.trace"; // --trace-file=PATH
+    string decode_trace;       // --decode-trace FILE: print a trace against the program, don't run
+};
+
+// Parse, optimize and lower source text the way the options ask for
+static void build_program(const Options &opt, const MappedFile &src, vector<Instruction*> &prog, SymbolTable &syms, Bytecode &bc) {
+    prog = parse_program(src.data, src.size, syms);
+    if (opt.opt_level > 0) optimize_program(prog);
+    if (!opt.classic) bc = lower_program(prog, opt.opt_level);
+}
+
+// Load opt.file for running. A compiled image goes straight into bc; with
+// --cache a bytecode run first looks for the compiled form of the same
+// source text and stores it after a miss. *level is the optimization level
+// bc was built with. Returns where the program came from.
+static const char *load_image(const Options &opt, vector<Instruction*> &prog, SymbolTable &syms, Bytecode &bc, size_t *bytes,
+                              int *level) {
+    MappedFile src(opt.file);
+    if (bytes) *bytes = src.size;
+    *level = opt.opt_level;
+    if (is_compiled(src.data, src.size)) {
+        if (opt.classic) throw runtime_error("compiled programs run on the bytecode engine only");
+        CompiledHeader h;
+        read_compiled(src.data, src.size, bc, syms, &h);
+        *level = (int)h.opt_level;
+        return "compiled";
+    }
+    if (!opt.cache || opt.classic) {
+        build_program(opt, src, prog, syms, bc);
+        return "source";
+    }
+
+    unsigned long long key = fnv1a(src.data, src.size);
+    string dir = opt.cache_dir.empty() ? default_cache_dir() : opt.cache_dir;
+    char name[48];
+    snprintf(name, sizeof name, "/%016llx-O%d.pplc", key, opt.opt_level);
+    string path = dir + name;
+    if (!dir.empty()) {
+        try {
+            MappedFile hit(path);
+            CompiledHeader h;
+            Bytecode cbc;
+            SymbolTable csyms;
+            read_compiled(hit.data, hit.size, cbc, csyms, &h);
+            if (h.source_hash == key && h.source_size == src.size && (int)h.opt_level == opt.opt_level) {
+                bc = move(cbc);
+                syms = move(csyms);
+                return "cache";
+            }
+        } catch (const runtime_error &) {
+            // missing or stale entry: rebuild below
+        }
+    }
+    build_program(opt, src, prog, syms, bc);
+    if (!dir.empty()) {
+        try {
+            make_dirs(dir);
+            write_compiled(path, bc, syms, opt.opt_level, key, src.size);
+        } catch (const runtime_error &) {
+            // the cache is best effort
+        }
+    }
+    return "source";
+}
+
+// load_image, then drop the runtime checks the bytecode provably never needs
+static const char *load_for_run(const Options &opt, vector<Instruction*> &prog, SymbolTable &syms, Bytecode &bc, size_t *bytes) {
+    int level;
+    const char *origin = load_image(opt, prog, syms, bc, bytes, &level);
+    if (!opt.classic && level > 0) specialize_checks(bc, syms, opt.seeded, nullptr, nullptr, opt.big_ints);
+    return origin;
+}
+
+// Identity of the code a snapshot pc or generated C++ refers to: every
+// record and symbol name
+static unsigned long long program_hash(const vector<BInstr> &code, const SymbolTable &syms) {
+    string key;
+    for (const BInstr &r : code) {
+        long long f[5] = {r.imm, r.a, r.b, r.line, r.op};
+        key.append(reinterpret_cast<const char*>(f), sizeof f);
+    }
+    for (const string &name : syms.names) { key += name; key += '\0'; }
+    return fnv1a(key.data(), key.size());
+}
+
+// Build the code --emit-cpp translates, and that load_native checks it
+// against: loops are left to the C++ compiler, so at most -O1. Returns the
+// hash of the lowered code before the checks are specialized.
+static unsigned long long build_native(const char *text, size_t size, int opt_level, SymbolTable &syms, Bytecode &bc) {
+    vector<Instruction*> prog = parse_program(text, size, syms);
+    if (opt_level > 0) optimize_program(prog);
+    bc = lower_program(prog, min(opt_level, 1));
+    free_program(prog);
+    unsigned long long hash = program_hash(bc.code, syms);
+    if (opt_level > 0) specialize_checks(bc, syms, true);
+    return hash;
+}
+
+// Embedding API (ppl.h)
+namespace ppl {
+
+struct ProgramData {
+    SymbolTable syms;
+    Bytecode bc;
+    native::RunFn native = nullptr; // generated code (load_native), bc as the fallback
+    void *module = nullptr;         // its dlopen handle
+    ~ProgramData() { if (module) dlclose(module); }
+};
+
+struct ContextData {
+    Env env;
+    long long steps;
+    explicit ContextData(const SymbolTable &s) : env(s), steps(0) {}
+};
+
+Program::Program() : d(new ProgramData) {}
+Program::~Program() {}
+
+shared_ptr<const Program> Program::load(const string &file, int opt_level) {
+    shared_ptr<Program> p(new Program);
+    Options opt;
+    opt.file = file;
+    opt.opt_level = opt_level;
+    opt.seeded = true;
+    vector<Instruction*> prog;
+    try {
+        load_for_run(opt, prog, p->d->syms, p->d->bc, nullptr);
+    } catch (...) {
+        free_program(prog);
+        throw;
+    }
+    free_program(prog);
+    return p;
+}
+
+shared_ptr<const Program> Program::parse(const string &text, int opt_level) {
+    shared_ptr<Program> p(new Program);
+    vector<Instruction*> prog = parse_program(text.data(), text.size(), p->d->syms);
+    if (opt_level > 0) optimize_program(prog);
+    p->d->bc = lower_program(prog, opt_level);
+    if (opt_level > 0) specialize_checks(p->d->bc, p->d->syms, true);
+    free_program(prog);
+    return p;
+}
+
+shared_ptr<const Program> Program::load_native(const string &file) {
+    void *module = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!module) throw runtime_error("Unable to load " + file + ": " + dlerror());
+    shared_ptr<Program> p(new Program);
+    p->d->module = module;
+    const native::Module *m = static_cast<const native::Module*>(dlsym(module, "ppl_native_module"));
+    if (!m) throw runtime_error(file + " is not a generated PPL program");
+    if (m->abi != native::ABI_VERSION) throw runtime_error(file + " was generated for a different PPL runtime");
+    // the names and the fallback bytecode come from the embedded source
+    if (build_native(m->source, m->source_size, m->opt_level, p->d->syms, p->d->bc) != m->program_hash)
+        throw runtime_error(file + " was generated by a different PPL version");
+    p->d->native = m->run;
+    return p;
+}
+
+int Program::slot(const string &name) const { return d->syms.find(name); }
+int Program::slots() const { return d->syms.size(); }
+const string &Program::name(int slot) const { return d->syms.names.at(slot); }
+
+Context::Context(shared_ptr<const Program> p) : prog(p), d(new ContextData(p->data().syms)) {}
+Context::~Context() {}
+
+void Context::reset() {
+    d->env.reset();
+    d->steps = 0;
+}
+
+static void check_slot(const Env &env, int slot) {
+    if (slot < 0 || slot >= (int)env.frame.size()) throw runtime_error("no such slot: " + to_string(slot));
+}
+
+void Context::set_int(int slot, long long v) {
+    check_slot(d->env, slot);
+    d->env.set(slot, Value::make_int(v));
+}
+
+void Context::set_list(int slot, const long long *items, size_t n) {
+    check_slot(d->env, slot);
+    ListPtr l;
+    for (size_t i = n; i-- > 0;) l = d->env.arena.cons(Value::make_int(items[i]), move(l));
+    d->env.set(slot, Value::make_list(l));
+}
+
+// Runtime for generated code. Each instruction is the classic engine's own
+// execute(), so checks, messages and list sharing are the interpreter's.
+namespace native {
+struct Frame {
+    Env &env;
+    Budget budget;
+    explicit Frame(Env &e) : env(e), budget(e) {}
+};
+}
+
+static const vector<Instruction*> no_program;
+
+// MERGE and CONCAT can outgrow a list; put their line on that error
+static void rt_growing(const Instruction &ins, Env &env) {
+    try {
+        ins.execute(env, 0, no_program);
+    } catch (const ListTooLong &e) {
+        bc_fail_at(ins.lineNo, e.what());
+    }
+}
+
+static void rt_integer(native::Frame &f, int x, int line) { Instr_INTEGER(line, x).execute(f.env, 0, no_program); }
+static void rt_list(native::Frame &f, int x, int line) { Instr_LIST(line, x).execute(f.env, 0, no_program); }
+static void rt_merge(native::Frame &f, int a, int l, int line) { rt_growing(Instr_MERGE(line, a, l), f.env); }
+static void rt_copy(native::Frame &f, int a, int b, int line) { Instr_COPY(line, a, b).execute(f.env, 0, no_program); }
+static void rt_head(native::Frame &f, int l, int x, int line) { Instr_HEAD(line, l, x).execute(f.env, 0, no_program); }
+static void rt_tail(native::Frame &f, int a, int b, int line) { Instr_TAIL(line, a, b).execute(f.env, 0, no_program); }
+static void rt_pop(native::Frame &f, int l, int x, int line) { Instr_POP(line, l, x).execute(f.env, 0, no_program); }
+static void rt_len(native::Frame &f, int l, int x, int line) { Instr_LEN(line, l, x).execute(f.env, 0, no_program); }
+static void rt_sum(native::Frame &f, int l, int x, int line) { Instr_SUM(line, l, x).execute(f.env, 0, no_program); }
+static void rt_range(native::Frame &f, int n, int l, int line) { Instr_RANGE(line, n, l).execute(f.env, 0, no_program); }
+static void rt_fill(native::Frame &f, int x, int l, int line) { Instr_FILL(line, x, l).execute(f.env, 0, no_program); }
+static void rt_reverse(native::Frame &f, int l, int line) { Instr_REVERSE(line, l).execute(f.env, 0, no_program); }
+static void rt_concat(native::Frame &f, int a, int l, int line) { rt_growing(Instr_CONCAT(line, a, l), f.env); }
+static void rt_assign(native::Frame &f, int x, long long v, int line) { Instr_ASSIGN(line, x, v).execute(f.env, 0, no_program); }
+static void rt_chs(native::Frame &f, int x, int line) { Instr_CHS(line, x).execute(f.env, 0, no_program); }
+static void rt_add(native::Frame &f, int a, int b, int line) { Instr_ADD(line, a, b).execute(f.env, 0, no_program); }
+static void rt_sub(native::Frame &f, int a, int b, int line, int add_line) {
+    Instr_SUB(line, add_line, a, b).execute(f.env, 0, no_program);
+}
+
+static bool rt_if_zero(native::Frame &f, int x, int line) {
+    if (!f.env.exists(x)) bc_fail_at(line, "IF undefined id: " + f.env.name(x));
+    const Value &v = f.env.get_const(x);
+    return v.type == VT_INT ? v.ival == 0 : v.lref == 0;
+}
+
+static bool rt_load_int(native::Frame &f, int x, long long *v, bool *defined) {
+    const Value &val = f.env.get_const(x);
+    *defined = f.env.exists(x);
+    if (*defined && val.type != VT_INT) return false;
+    *v = *defined ? val.ival : 0;
+    return true;
+}
+
+static void rt_store_int(native::Frame &f, int x, long long v, bool defined) {
+    f.env.frame[x] = Value::make_int(defined ? v : 0);
+    f.env.defined[x] = defined;
+}
+
+static void rt_fail(native::Frame &f, int line, const char *msg, int slot) {
+    bc_fail_at(line, slot < 0 ? string(msg) : msg + f.env.name(slot));
+}
+
+static bool rt_limited(native::Frame &f) { return f.budget.active; }
+
+static void rt_back_edge(native::Frame &f, int target, long long steps, int line) {
+    if (!f.budget.due(steps)) return;
+    try {
+        f.budget.back_edge(target, steps);
+    } catch (LimitExceeded &e) {
+        e.line = line;
+        e.steps = steps;
+        throw;
+    }
+}
+
+static const native::Runtime native_runtime = {
+    rt_integer, rt_list, rt_merge, rt_copy, rt_head, rt_tail, rt_pop, rt_len, rt_sum, rt_range, rt_fill, rt_reverse, rt_concat, rt_assign, rt_chs, rt_add, rt_sub,
+    rt_if_zero, rt_load_int, rt_store_int, rt_fail, rt_limited, rt_back_edge
+};
+
+bool Context::run(string *error) {
+    const ProgramData &pd = prog->data();
+    try {
+        long long steps = -1;
+        if (pd.native) {
+            native::Frame f(d->env);
+            steps = pd.native(f, native_runtime);
+        }
+        if (steps < 0) steps = try_bytecode(pd.bc, d->env);
+        if (steps < 0) {
+            if (error) *error = d->env.error_message();
+            return false;
+        }
+        d->steps = steps;
+    } catch (const LimitExceeded &e) {
+        d->steps = e.steps;
+        if (error) *error = string("limit exceeded: ") + e.what() + " at line " + std::to_string(e.line);
+        return false;
+    } catch (const runtime_error &e) {
+        if (error) *error = e.what();
+        return false;
+    }
+    return true;
+}
+
+long long Context::steps() const { return d->steps; }
+
+void Context::set_limits(long long max_steps, size_t max_memory, double timeout) {
+    RunLimits l;
+    l.max_steps = max_steps;
+    l.max_memory = max_memory;
+    l.timeout = timeout;
+    d->env.set_limits(l);
+}
+
+bool Context::defined(int slot) const { return slot >= 0 && slot < (int)d->env.frame.size() && d->env.exists(slot); }
+bool Context::is_int(int slot) const { return defined(slot) && d->env.get_const(slot).type == VT_INT; }
+bool Context::is_list(int slot) const { return defined(slot) && d->env.get_const(slot).type == VT_LIST; }
+
+long long Context::get_int(int slot) const {
+    if (!is_int(slot)) throw runtime_error("not an int: " + (defined(slot) ? d->env.name(slot) : std::to_string(slot)));
+    return d->env.get_const(slot).ival;
+}
+
+bool Context::get_list(int slot, vector<long long> &out) const {
+    out.clear();
+    if (!is_list(slot)) return false;
+    out.reserve(list_length(d->env.get_const(slot).lref));
+    for (ListRef r = d->env.get_const(slot).lref; r; r = list_next(r)) {
+        if (!is_slot_ref(r) && node_of(r)->v.type != VT_INT) { out.clear(); return false; }
+        out.push_back(is_slot_ref(r) ? *slot_of(r) : node_of(r)->v.ival);
+    }
+    return true;
+}
+
+string Context::to_string(int slot) const {
+    check_slot(d->env, slot);
+    return value_to_string(d->env.get_const(slot));
+}
+
+} // namespace ppl
+
+#ifndef PPL_NO_MAIN
+static void on_suspend_signal(int) { suspend_requested = 1; }
+
+// The same for the classic engine
+static unsigned long long program_hash(const vector<Instruction*> &prog, const SymbolTable &syms) {
+    vector<BInstr> code;
+    for (const Instruction *ins : prog) code.push_back(lowered(ins));
+    return program_hash(code, syms);
+}
+
+// Byte count with an optional K, M or G suffix (powers of 1024)
+static bool parse_size(const char *s, size_t &out) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) return false;
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') shift = 10;
+    else if (*end == 'M' || *end == 'm') shift = 20;
+    else if (*end == 'G' || *end == 'g') shift = 30;
+    if (shift) ++end;
+    if (*end || v == 0 || v > (SIZE_MAX >> shift)) return false;
+    out = (size_t)(v << shift);
+    return true;
+}
+
+static bool parse_args(int argc, char **argv, Options &opt) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--engine=classic") opt.classic = true;
+        else if (arg == "--engine=bytecode") opt.classic = false;
+        else if (arg == "--lists=persistent") { opt.persistent = true; opt.hashcons = false; }
+        else if (arg == "--lists=copy") { opt.persistent = false; opt.hashcons = false; }
+        else if (arg == "--lists=hashcons") opt.persistent = opt.hashcons = true;
+        else if (arg == "--ints=wrap") opt.big_ints = false;
+        else if (arg == "--ints=big") opt.big_ints = true;
+        else if (arg == "--arena-stats") opt.arena_stats = true;
+        else if (arg == "--profile") opt.profile = true;
+        else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && isdigit((unsigned char)arg[2])) opt.opt_level = arg[2] - '0';
+        else if (arg == "--output=text") opt.format = OUT_TEXT;
+        else if (arg == "--output=json") opt.format = OUT_JSON;
+        else if (arg == "--output=binary") opt.format = OUT_BINARY;
+        else if (arg == "--compile") opt.compile = true;
+        else if (arg == "--check") opt.check = true;
+        else if (arg == "--emit-cpp") opt.emit_cpp = true;
+        else if (arg.compare(0, 12, "--max-steps=") == 0) {
+            opt.limits.max_steps = atoll(arg.c_str() + 12);
+            if (opt.limits.max_steps <= 0) return false;
+        }
+        else if (arg.compare(0, 13, "--max-memory=") == 0) {
+            if (!parse_size(arg.c_str() + 13, opt.limits.max_memory)) return false;
+        }
+        else if (arg == "--snapshot" && i + 1 < argc) opt.snapshot = argv[++i];
+        else if (arg.compare(0, 17, "--snapshot-every=") == 0) {
+            opt.snapshot_every = atof(arg.c_str() + 17);
+            if (!(opt.snapshot_every > 0)) return false;
+        }
+        else if (arg == "--resume" && i + 1 < argc) opt.resume = argv[++i];
+        else if (arg.compare(0, 8, "--trace=") == 0) {
+            opt.trace = atoi(arg.c_str() + 8);
+            if (opt.trace <= 0) return false;
+        }
+        else if (arg.compare(0, 13, "--trace-file=") == 0 && arg.size() > 13) opt.trace_file = arg.substr(13);
+        else if (arg == "--decode-trace" && i + 1 < argc) opt.decode_trace = argv[++i];
+        else if (arg.compare(0, 10, "--timeout=") == 0) {
+            opt.limits.timeout = atof(arg.c_str() + 10);
+            if (!(opt.limits.timeout > 0)) return false;
+        }
+        else if (arg == "-o" && i + 1 < argc) opt.output = argv[++i];
+        else if (arg == "--cache") opt.cache = true;
+        else if (arg.compare(0, 8, "--cache=") == 0 && arg.size() > 8) { opt.cache = true; opt.cache_dir = arg.substr(8); }
+        else if (arg == "--batch" && i + 1 < argc) opt.batch = argv[++i];
+        else if (arg == "--serve") opt.serve = true;
+        else if (arg == "-j" && i + 1 < argc) {
+            opt.jobs = atoi(argv[++i]);
+            if (opt.jobs <= 0) return false;
+        }
+        else if (arg.size() > 2 && arg[0] == '-' && arg[1] == 'j') {
+            opt.jobs = atoi(arg.c_str() + 2);
+            if (opt.jobs <= 0) return false;
+        }
+        else if (arg == "--bench" && i + 1 < argc) {
+            opt.bench_runs = atoi(argv[++i]);
+            if (opt.bench_runs <= 0) return false;
+        }
+        else if (opt.file.empty() && (arg.empty() || arg[0] != '-')) opt.file = arg;
+        else return false;
+    }
+    if (!opt.output.empty() && !opt.compile && !opt.emit_cpp) return false;
+    if (opt.emit_cpp && (opt.big_ints || opt.compile || opt.check || !opt.batch.empty() || opt.bench_runs > 0)) return false;
+    if (opt.check && (opt.compile || !opt.batch.empty() || opt.bench_runs > 0)) return false;
+    if (opt.snapshot_every > 0 && opt.snapshot.empty()) return false;
+    if ((!opt.snapshot.empty() || !opt.resume.empty()) &&
+        (opt.compile || opt.emit_cpp || opt.check || !opt.batch.empty() || opt.bench_runs > 0))
+        return false;
+    if ((opt.trace > 0 || !opt.decode_trace.empty()) &&
+        (opt.compile || opt.emit_cpp || opt.check || opt.profile || opt.serve || !opt.batch.empty() || opt.bench_runs > 0))
+        return false;
+    if (!opt.decode_trace.empty() && (opt.trace > 0 || !opt.snapshot.empty() || !opt.resume.empty())) return false;
+    if (!opt.batch.empty()) return opt.file.empty() && !opt.compile && !opt.profile && opt.bench_runs == 0;
+    if (opt.serve)
+        return opt.file.empty() && !opt.compile && !opt.check && !opt.emit_cpp && !opt.profile && !opt.cache &&
+               opt.bench_runs == 0 && opt.format == OUT_TEXT && opt.snapshot.empty() && opt.resume.empty();
+    return !opt.file.empty();
+}
+
+static double seconds_since(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+static long peak_rss_kb() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return ru.ru_maxrss; // kilobytes on Linux
+}
+
+// --compile: write the lowered program to opt.output
+static int run_compile(const Options &opt) {
+    string out = opt.output.empty() ? opt.file + "c" : opt.output;
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    try {
+        MappedFile src(opt.file);
+        if (is_compiled(src.data, src.size)) throw runtime_error(opt.file + " is already compiled");
+        Options o = opt;
+        o.classic = false;
+        build_program(o, src, prog, syms, bc);
+        write_compiled(out, bc, syms, opt.opt_level, fnv1a(src.data, src.size), src.size);
+    } catch (const exception &e) {
+        cerr << "Error compiling program: " << e.what() << endl;
+        free_program(prog);
+        return 1;
+    }
+    free_program(prog);
+    return 0;
+}
+
+// --emit-cpp: translate the program into one C++ function over the
+// ppl::native runtime. Each record becomes a labelled statement and IF a
+// conditional goto. Identifiers that only ever hold ints live in locals;
+// everything else, lists included, goes through the host's runtime, so the
+// generated code behaves exactly like the interpreter it came from.
+static string cpp_int(long long v) {
+    return v == LLONG_MIN ? string("(-9223372036854775807LL - 1)") : to_string(v) + "LL";
+}
+
+static void emit_cpp(ostream &os, const string &file, const char *text, size_t size, int level, const Bytecode &bc,
+                     const SymbolTable &syms, unsigned long long hash) {
+    const vector<BInstr> &code = bc.code;
+    const int nsyms = syms.size();
+    // int-only: never read or written as a list; used: has a local
+    vector<char> local(nsyms, 1), used(nsyms, 0);
+    vector<char> target(code.size(), 0);
+    bool back_edges = false;
+    for (int i = 0; i < (int)code.size(); ++i) {
+        const BInstr &r = code[i];
+        switch (r.op) {
+        case OP_LIST: case OP_LIST_U:
+            local[r.a] = 0;
+            break;
+        case OP_MERGE: case OP_MERGE_U:
+            used[r.a] = 1; local[r.b] = 0;
+            break;
+        case OP_COPY: case OP_COPY_U: case OP_HEAD: case OP_HEAD_U: case OP_TAIL: case OP_TAIL_U:
+        case OP_POP: case OP_POP_U:
+            local[r.a] = local[r.b] = 0;
+            break;
+        case OP_LEN: case OP_LEN_U: case OP_SUM:
+            local[r.a] = 0; used[r.b] = 1;
+            break;
+        case OP_RANGE: case OP_FILL:
+            used[r.a] = 1; local[r.b] = 0;
+            break;
+        case OP_REVERSE:
+            local[r.a] = 0;
+            break;
+        case OP_CONCAT:
+            local[r.a] = local[r.b] = 0;
+            break;
+        case OP_ADD: case OP_ADD_U: case OP_SUB: case OP_SUB_U:
+            used[r.b] = 1;
+            // fall through
+        case OP_INTEGER: case OP_INTEGER_U: case OP_ASSIGN: case OP_ASSIGN_U: case OP_CHS: case OP_CHS_U:
+        case OP_IF: case OP_IF_INT: case OP_IF_LIST:
+            used[r.a] = 1;
+            break;
+        }
+        if ((r.op == OP_IF || r.op == OP_IF_INT || r.op == OP_IF_LIST || r.op == OP_JMP) && r.b >= 0) {
+            target[r.b] = 1;
+            if (r.b <= i) back_edges = true;
+        }
+    }
+    for (int s = 0; s < nsyms; ++s) local[s] = local[s] && used[s];
+    auto v = [](int s) { return "v" + to_string(s); };
+    auto d = [](int s) { return "d" + to_string(s); };
+    auto spill = [&](int s) { if (local[s]) os << "        rt.store_int(fr, " << s << ", " << v(s) << ", " << d(s) << ");\n"; };
+    auto reload = [&](int s) { if (local[s]) os << "        rt.load_int(fr, " << s << ", &" << v(s) << ", &" << d(s) << ");\n"; };
+    auto fail_if = [&](const string &cond, int line, const char *msg, int s) {
+        os << "        if (" << cond << ") rt.fail(fr, " << line << ", \"" << msg << "\", " << s << ");\n";
+    };
+    auto jump = [&](int i, const BInstr &r) {
+        if (r.b < 0) {
+            os << "rt.fail(fr, " << r.line << ", \"IF jump out of range: " << r.imm << "\", -1);\n";
+            return;
+        }
+        if (r.b <= i) os << "{ if (limited) rt.back_edge(fr, " << r.b << ", steps, " << r.line << "); goto L" << r.b << "; }\n";
+        else os << "goto L" << r.b << ";\n";
+    };
+
+    os << "// Generated by ppl --emit-cpp from " << file << " (-O" << level << "). Build with\n"
+       << "//   g++ -std=c++11 -O2 -shared -fPIC -I<dir of ppl.h> <this file> -o prog.so\n"
+       << "// and load it with ppl::Program::load_native(\"prog.so\").\n"
+       << "#include \"ppl.h\"\n\n"
+       << "namespace {\n\n"
+       << "const char source[] =\n    \"";
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\n') os << (i + 1 < size ? "\\n\"\n    \"" : "\\n");
+        else if (c == '"' || c == '\\' || c == '?') os << '\\' << c; // '?': no trigraphs
+        else if (c >= 0x20 && c < 0x7f) os << c;
+        else { char esc[8]; snprintf(esc, sizeof esc, "\\%03o", c); os << esc; }
+    }
+    os << "\";\n\n"
+       << "long long run(ppl::native::Frame &fr, const ppl::native::Runtime &rt) {\n"
+       << "    using ppl::native::wrap_add;\n"
+       << "    using ppl::native::wrap_sub;\n"
+       << "    using ppl::native::wrap_neg;\n"
+       << "    long long steps = 0;\n";
+    if (back_edges) os << "    const bool limited = rt.limited(fr);\n";
+    for (int s = 0; s < nsyms; ++s)
+        if (local[s]) os << "    long long " << v(s) << "; bool " << d(s) << "; // " << syms.names[s] << "\n";
+    for (int s = 0; s < nsyms; ++s)
+        if (local[s]) os << "    if (!rt.load_int(fr, " << s << ", &" << v(s) << ", &" << d(s) << ")) return -1;\n";
+    os << "    auto spill = [&]() {\n";
+    for (int s = 0; s < nsyms; ++s)
+        if (local[s]) os << "        rt.store_int(fr, " << s << ", " << v(s) << ", " << d(s) << ");\n";
+    os << "    };\n"
+       << "    try {\n";
+
+    for (int i = 0; i < (int)code.size(); ++i) {
+        const BInstr &r = code[i];
+        const int a = r.a, b = r.b, line = r.line;
+        const bool reached = i == 0 || target[i] || (code[i - 1].op != OP_HLT && code[i - 1].op != OP_JMP);
+        if (target[i]) os << "    L" << i << ":\n";
+        if (i == bc.end) {
+            if (reached) os << "        spill();\n        return steps;\n";
+            continue;
+        }
+        os << "        // " << line << ": " << op_names[r.op];
+        if (a >= 0 && r.op != OP_JMP) os << " " << syms.names[a];
+        if (b >= 0 && !is_jump(r.op) && r.op != OP_IF_INT && r.op != OP_IF_LIST) os << " " << syms.names[b];
+        if (r.op == OP_ASSIGN || r.op == OP_ASSIGN_U || is_jump(r.op) || r.op == OP_IF_INT || r.op == OP_IF_LIST)
+            os << " " << r.imm;
+        os << "\n        ++steps;\n";
+        switch (r.op) {
+        case OP_NOP:
+            break;
+        case OP_INTEGER: case OP_INTEGER_U:
+            if (!local[a]) { os << "        rt.integer(fr, " << a << ", " << line << ");\n"; break; }
+            if (r.op == OP_INTEGER) fail_if(d(a), line, "Identifier already declared: ", a);
+            os << "        " << v(a) << " = 0; " << d(a) << " = true;\n";
+            break;
+        case OP_LIST: case OP_LIST_U:
+            os << "        rt.list(fr, " << a << ", " << line << ");\n";
+            break;
+        case OP_MERGE: case OP_MERGE_U:
+            spill(a);
+            os << "        rt.merge(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_COPY: case OP_COPY_U:
+            os << "        rt.copy(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_HEAD: case OP_HEAD_U:
+            os << "        rt.head(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_TAIL: case OP_TAIL_U:
+            os << "        rt.tail(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_POP: case OP_POP_U:
+            os << "        rt.pop(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_LEN: case OP_LEN_U:
+            // the result is always an int, so it may live in a local
+            os << "        rt.len(fr, " << a << ", " << b << ", " << line << ");\n";
+            reload(b);
+            break;
+        case OP_SUM:
+            os << "        rt.sum(fr, " << a << ", " << b << ", " << line << ");\n";
+            reload(b);
+            break;
+        case OP_RANGE:
+            spill(a);
+            os << "        rt.range(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_FILL:
+            spill(a);
+            os << "        rt.fill(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_REVERSE:
+            os << "        rt.reverse(fr, " << a << ", " << line << ");\n";
+            break;
+        case OP_CONCAT:
+            os << "        rt.concat(fr, " << a << ", " << b << ", " << line << ");\n";
+            break;
+        case OP_ASSIGN: case OP_ASSIGN_U:
+            // an int-only identifier can always be assigned
+            if (local[a]) os << "        " << v(a) << " = " << cpp_int(r.imm) << "; " << d(a) << " = true;\n";
+            else os << "        rt.assign(fr, " << a << ", " << cpp_int(r.imm) << ", " << line << ");\n";
+            break;
+        case OP_CHS: case OP_CHS_U:
+            if (!local[a]) { os << "        rt.chs(fr, " << a << ", " << line << ");\n"; break; }
+            if (r.op == OP_CHS) fail_if("!" + d(a), line, "CHS undefined id: ", a);
+            os << "        " << v(a) << " = wrap_neg(" << v(a) << ");\n";
+            break;
+        case OP_ADD: case OP_ADD_U:
+            if (local[a] && local[b]) {
+                if (r.op == OP_ADD) {
+                    fail_if("!" + d(a), line, "ADD undefined id: ", a);
+                    fail_if("!" + d(b), line, "ADD undefined id: ", b);
+                }
+                os << "        " << v(a) << " = wrap_add(" << v(a) << ", " << v(b) << ");\n";
+                break;
+            }
+            spill(a); spill(b);
+            os << "        rt.add(fr, " << a << ", " << b << ", " << line << ");\n";
+            reload(a);
+            break;
+        case OP_SUB: case OP_SUB_U:
+            if (local[a] && local[b]) {
+                if (r.op == OP_SUB) {
+                    fail_if("!" + d(b), line, "CHS undefined id: ", b);
+                    fail_if("!" + d(a), (int)r.imm, "ADD undefined id: ", a);
+                }
+                os << "        " << v(a) << " = wrap_sub(" << v(a) << ", " << v(b) << ");\n";
+                break;
+            }
+            spill(a); spill(b);
+            os << "        rt.sub(fr, " << a << ", " << b << ", " << line << ", " << r.imm << ");\n";
+            reload(a);
+            break;
+        case OP_IF: case OP_IF_INT: case OP_IF_LIST:
+            if (local[a]) {
+                if (r.op == OP_IF) fail_if("!" + d(a), line, "IF undefined id: ", a);
+                os << "        if (" << v(a) << " == 0) ";
+            } else {
+                os << "        if (rt.if_zero(fr, " << a << ", " << line << ")) ";
+            }
+            jump(i, r);
+            break;
+        case OP_JMP:
+            os << "        ";
+            jump(i, r);
+            break;
+        case OP_HLT:
+            os << "        spill();\n        return steps;\n";
+            break;
+        default:
+            throw runtime_error(string("cannot emit ") + op_names[r.op]);
+        }
+    }
+    os << "    } catch (...) {\n"
+       << "        spill();\n"
+       << "        throw;\n"
+       << "    }\n"
+       << "}\n\n"
+       << "} // namespace\n\n"
+       << "extern \"C\" const ppl::native::Module ppl_native_module = {\n"
+       << "    ppl::native::ABI_VERSION, source, sizeof source - 1, " << level << ", 0x" << hex << hash << dec << "ULL, run\n"
+       << "};\n";
+}
+
+static int run_emit_cpp(const Options &opt) {
+    string out = opt.output.empty() ? opt.file + ".cpp" : opt.output;
+    try {
+        MappedFile src(opt.file);
+        if (is_compiled(src.data, src.size)) throw runtime_error(opt.file + " is compiled; --emit-cpp needs the source");
+        SymbolTable syms;
+        Bytecode bc;
+        int level = min(opt.opt_level, 1);
+        unsigned long long hash = build_native(src.data, src.size, level, syms, bc);
+        ofstream os(out.c_str(), ios::binary);
+        if (!os) throw runtime_error("Unable to write file: " + out);
+        emit_cpp(os, opt.file, src.data, src.size, level, bc, syms, hash);
+        os.close();
+        if (!os) throw runtime_error("Unable to write file: " + out);
+    } catch (const exception &e) {
+        cerr << "Error emitting program: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// --check: run the static analysis alone and list every reachable
+// instruction that fails on all paths into it. Exit status 1 if any.
+static int run_check(const Options &opt) {
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    vector<string> diags;
+    bool analyzed;
+    try {
+        Options o = opt;
+        o.classic = false;
+        int level;
+        load_image(o, prog, syms, bc, nullptr, &level);
+        analyzed = specialize_checks(bc, syms, false, &diags);
+    } catch (const exception &e) {
+        cerr << "Error loading program: " << e.what() << endl;
+        free_program(prog);
+        return 1;
+    }
+    free_program(prog);
+    if (!analyzed) {
+        cerr << "Error: program too large to check" << endl;
+        return 1;
+    }
+    for (const string &d : diags) cout << opt.file << ": " << d << "\n";
+    return diags.empty() ? 0 : 1;
+}
+
+// --bench N: load once, run N times on fresh environments without printing,
+// then report wall time, instruction rate and peak RSS.
+static int run_bench(const Options &opt) {
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    size_t bytes = 0;
+    const char *origin;
+    auto t0 = chrono::steady_clock::now();
+    try {
+        origin = load_for_run(opt, prog, syms, bc, &bytes);
+    } catch (const exception &e) {
+        cerr << "Error loading program: " << e.what() << endl;
+        free_program(prog);
+        return 1;
+    }
+    double load_s = seconds_since(t0);
+
+    double total = 0, best = 0;
+    long long steps = 0;
+    for (int r = 0; r < opt.bench_runs; ++r) {
+        auto t1 = chrono::steady_clock::now();
+        try {
+            Env env(syms);
+            env.persistent_lists = opt.persistent;
+            env.big_ints = opt.big_ints;
+            env.arena.hashcons = opt.hashcons;
+            env.set_limits(opt.limits);
+            steps = opt.classic ? exec_classic(prog, env) : try_bytecode(bc, env);
+            if (steps < 0) {
+                cerr << "Runtime error: " << env.error_message() << endl;
+                free_program(prog);
+                return 1;
+            }
+        } catch (const LimitExceeded &e) {
+            cerr << "Limit exceeded: " << e.what() << " at line " << e.line << " after " << e.steps << " steps" << endl;
+            free_program(prog);
+            return 2;
+        } catch (const runtime_error &e) {
+            cerr << "Runtime error: " << e.what() << endl;
+            free_program(prog);
+            return 1;
+        }
+        double t = seconds_since(t1);
+        total += t;
+        if (r == 0 || t < best) best = t;
+    }
+    free_program(prog);
+
+    double mean = total / opt.bench_runs;
+    cout << "bench: " << opt.file << " (engine=" << (opt.classic ? "classic" : "bytecode")
+         << ", lists=" << (opt.hashcons ? "hashcons" : opt.persistent ? "persistent" : "copy") << ", -O" << opt.opt_level << ", runs=" << opt.bench_runs << ")\n"
+         << "  load      " << load_s * 1e3 << " ms (" << origin << ", " << bytes << " bytes, "
+         << (load_s > 0 ? bytes / load_s / 1e6 : 0.0) << " MB/s)\n"
+         << "  run       min " << best * 1e3 << " ms, mean " << mean * 1e3 << " ms, total " << total * 1e3 << " ms\n"
+         << "  steps     " << steps << " per run\n"
+         << "  rate      " << (best > 0 ? steps / best / 1e6 : 0.0) << " M instr/s (best run)\n"
+         << "  peak RSS  " << peak_rss_kb() << " KB\n";
+    return 0;
+}
+
+// --batch FILE: each line names a program to run (blank lines and lines
+// starting with '#' are skipped). Every distinct program is loaded once; jobs
+// then run on -j worker threads, each with its own Env and output buffers,
+// and results are printed in job order once all have finished.
+struct BatchProgram {
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    string error; // load failure, reported by every job that uses it
+};
+
+struct BatchJob {
+    string file;
+    const BatchProgram *program;
+    string out, err;
+    bool failed;
+};
+
+static void run_batch_job(const Options &opt, BatchJob &job) {
+    ostringstream out, err;
+    const BatchProgram &p = *job.program;
+    if (!p.error.empty()) {
+        err << "Error loading program: " << p.error << "\n";
+        job.failed = true;
+    } else {
+        try {
+            Env env(p.syms);
+            env.persistent_lists = opt.persistent;
+            env.big_ints = opt.big_ints;
+            env.arena.hashcons = opt.hashcons;
+            env.set_limits(opt.limits);
+            RunStatus status = opt.classic ? run_program(p.prog, env, nullptr, out, err, opt.format)
+                                           : run_bytecode(p.bc, env, nullptr, out, err, opt.format);
+            if (status == RUN_LIMIT) job.failed = true;
+            if (opt.arena_stats) print_arena_stats(env.arena, err);
+        } catch (const exception &e) {
+            err << "Error: " << e.what() << "\n";
+            job.failed = true;
+        }
+    }
+    job.out = out.str();
+    job.err = err.str();
+}
+
+static int run_batch(const Options &opt) {
+    vector<BatchJob> jobs;
+    map<string, unique_ptr<BatchProgram>> programs;
+    try {
+        MappedFile list(opt.batch);
+        const char *p = list.data, *end = list.data + list.size;
+        while (p < end) {
+            const char *nl = static_cast<const char*>(memchr(p, '\n', (size_t)(end - p)));
+            const char *eol = nl ? nl : end;
+            const char *b = p, *e = eol;
+            while (b < e && is_space(*b)) ++b;
+            while (e > b && is_space(e[-1])) --e;
+            if (b < e && *b != '#') {
+                BatchJob job;
+                job.file.assign(b, e);
+                job.program = nullptr;
+                job.failed = false;
+                jobs.push_back(job);
+            }
+            p = nl ? nl + 1 : end;
+        }
+    } catch (const exception &e) {
+        cerr << "Error reading batch file: " << e.what() << endl;
+        return 1;
+    }
+
+    for (BatchJob &job : jobs) {
+        unique_ptr<BatchProgram> &slot = programs[job.file];
+        if (!slot) {
+            slot.reset(new BatchProgram);
+            Options o = opt;
+            o.file = job.file;
+            try {
+                load_for_run(o, slot->prog, slot->syms, slot->bc, nullptr);
+            } catch (const exception &e) {
+                free_program(slot->prog);
+                slot->error = e.what();
+            }
+            if (!opt.classic) free_program(slot->prog); // lowered already
+        }
+        job.program = slot.get();
+    }
+
+    // Jobs are claimed from a shared counter, so a thread that finishes
+    // early simply takes the next one; no per-thread queues needed.
+    int nthreads = opt.jobs > 0 ? opt.jobs : (int)thread::hardware_concurrency();
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > jobs.size()) nthreads = (int)max<size_t>(jobs.size(), 1);
+    atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i; (i = next++) < jobs.size();) run_batch_job(opt, jobs[i]);
+    };
+    vector<thread> pool;
+    for (int t = 1; t < nthreads; ++t) pool.emplace_back(work);
+    work();
+    for (thread &t : pool) t.join();
+
+    int rc = 0;
+    for (const BatchJob &job : jobs) {
+        cout << "== " << job.file << "\n" << job.out;
+        size_t pos = 0;
+        while (pos < job.err.size()) {
+            size_t nl = job.err.find('\n', pos);
+            if (nl == string::npos) nl = job.err.size();
+            cerr << job.file << ": " << job.err.substr(pos, nl - pos) << "\n";
+            pos = nl + 1;
+        }
+        if (job.failed) rc = 1;
+    }
+    cout.flush();
+    for (auto &entry : programs) free_program(entry.second->prog);
+    return rc;
+}
+
+// --decode-trace FILE: one line per traced step, with identifier names,
+// for the program and the engine and -O options the trace was taken with
+static int run_decode_trace(const Options &opt) {
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    int level;
+    try {
+        load_image(opt, prog, syms, bc, nullptr, &level);
+        uint32_t engine = opt.classic ? SNAP_CLASSIC : SNAP_BYTECODE;
+        uint64_t program = opt.classic ? program_hash(prog, syms) : program_hash(bc.code, syms);
+        MappedFile f(opt.decode_trace);
+        const size_t hdr = 32;
+        uint32_t version, t_engine, count;
+        uint64_t t_program, steps;
+        if (f.size < hdr || memcmp(f.data, "PPLT", 4) != 0) throw runtime_error("not a trace file");
+        memcpy(&version, f.data + 4, 4);
+        memcpy(&t_engine, f.data + 8, 4);
+        memcpy(&t_program, f.data + 12, 8);
+        memcpy(&steps, f.data + 20, 8);
+        memcpy(&count, f.data + 28, 4);
+        if (version != PPLT_VERSION) throw runtime_error("unsupported trace version " + to_string(version));
+        if (t_engine != engine || t_program != program)
+            throw runtime_error("trace is from a different program, engine or -O level");
+        if ((f.size - hdr) / sizeof(TraceEntry) < count) throw runtime_error("truncated trace");
+        int ncode = opt.classic ? (int)prog.size() : (int)bc.code.size();
+        string out;
+        {
+            OutBuf o(out);
+            for (uint32_t i = 0; i < count; ++i) {
+                TraceEntry e;
+                memcpy(&e, f.data + hdr + i * sizeof e, sizeof e);
+                if ((int)e.index >= ncode || e.op >= OP_COUNT) throw runtime_error("trace entry out of range");
+                BInstr r = opt.classic ? lowered(prog[e.index]) : bc.code[e.index];
+                r.op = e.op; // as it ran, after specialization
+                int sa, sb;
+                trace_slots(r, sa, sb);
+                o.put('#');
+                o.put_int((long long)(steps - count + i + 1));
+                o.write(" line ");
+                o.put_int(e.line);
+                o.write(": ");
+                o.write(op_names[e.op], strlen(op_names[e.op]));
+                auto operand = [&](int slot, uint8_t tag, int64_t x) {
+                    if (slot < 0) return;
+                    o.put(' ');
+                    o.write(syms.names[slot]);
+                    o.put('=');
+                    if (tag == TT_NONE) o.write("undefined");
+                    else if (tag == TT_INT) o.put_int(x);
+                    else if (tag == TT_LIST) { o.write("list of "); o.put_int(x); }
+                    else { o.write(x < 0 ? "-big of " : "big of "); o.put_int(x < 0 ? -x : x); o.write(" limbs"); }
+                };
+                operand(sa, e.ta, e.a);
+                operand(sb, e.tb, e.b);
+                o.put('\n');
+            }
+        }
+        cout << out;
+    } catch (const exception &e) {
+        cerr << "Error decoding trace: " << e.what() << endl;
+        free_program(prog);
+        return 1;
+    }
+    free_program(prog);
+    return 0;
+}
+
+// --serve: a line protocol on stdin for tools that would otherwise start a
+// process per request. Every request gets its reply lines, then "ok ..." or
+// "error <message>" as its last line:
+//   load FILE          parse and lower FILE; ok <hash> <slots>
+//   run FILE|HASH [ID...]  run it in its warm Env (reset first) and print the
+//                      dump, or only the IDs; ok <steps>
+//   rerun FILE [ID...] like run, but resume from before the first line that
+//                      changed since the last rerun; ok <steps> <from line>
+//   exec INSTRUCTION   append a line to the session program and run from it
+//   get ID             one session identifier, as the dump prints it
+//   dump               every session identifier
+//   reset              empty the session program and its Env
+//   quit
+// Programs are kept by the fnv1a hash of their text, so a file that has not
+// changed is never parsed again. The session program keeps its lines even
+// when one fails, so IF targets keep their meaning.
+struct ServedProgram {
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    unique_ptr<Env> env;
+    ~ServedProgram() { free_program(prog); }
+};
+
+// rerun FILE: incremental re-execution of a file that is edited between
+// requests. The run records checkpoints at its frontier: a line reached
+// while every line executed so far lies above it. Everything before such a
+// checkpoint only ran lines above it, so after an edit below it the run can
+// carry on from there and get the same state it would starting at line 1.
+// A checkpoint holds only the identifiers written since the one before,
+// found through each line's written identifier, and shares their lists.
+// Runs use the classic engine on unoptimized lines, one Instruction per
+// source line, so checkpoints and edits line up.
+struct Checkpoint {
+    int line;                        // 1-based, not yet executed
+    long long steps;                 // instructions executed before it
+    vector<pair<int, Value>> delta;  // slots written since the previous checkpoint
+};
+
+struct EditedProgram {
+    string text;                     // what the checkpoints were recorded from
+    SymbolTable syms;                // only grows, so slots survive edits
+    vector<Instruction*> prog;
+    vector<int> writes;              // line - 1 -> the slot it writes, -1 for none
+    unique_ptr<Env> env;             // its arena is never reset: checkpoints share its cells
+    vector<Checkpoint> checkpoints;  // by line; declared after env so they drop their lists first
+    ~EditedProgram() { free_program(prog); }
+};
+
+// At most about this many checkpoints per run
+static const int EDIT_CHECKPOINTS = 64;
+
+// The slot an unoptimized instruction writes, -1 for none
+static int written_slot(const Instruction &ins) {
+    BInstr r = lowered(&ins);
+    switch (r.op) {
+    case OP_INTEGER: case OP_LIST: case OP_ASSIGN: case OP_CHS: case OP_ADD: case OP_REVERSE:
+        return r.a;
+    case OP_MERGE: case OP_COPY: case OP_HEAD: case OP_TAIL: case OP_LEN: case OP_SUM: case OP_RANGE: case OP_FILL:
+    case OP_CONCAT:
+        return r.b;
+    default:
+        return -1;
+    }
+}
+
+// 1-based number of the first line that differs between a and b
+static int first_changed_line(const string &a, const string &b) {
+    int line = 1;
+    for (size_t i = 0, n = min(a.size(), b.size()); i < n && a[i] == b[i]; ++i)
+        if (a[i] == '\n') ++line;
+    return line;
+}
+
+// Run p from its checkpoint k (-1: line 1), recording new checkpoints past
+// it. Returns the instructions executed by this call.
+static long long exec_checkpointed(EditedProgram &p, int k) {
+    Env &env = *p.env;
+    for (size_t s = 0; s < env.frame.size(); ++s) { env.frame[s] = Value(); env.defined[s] = 0; }
+    for (int i = 0; i <= k; ++i)
+        for (const pair<int, Value> &e : p.checkpoints[i].delta) env.set(e.first, e.second);
+    int pc = k < 0 ? 1 : p.checkpoints[k].line;
+    p.checkpoints.resize(k + 1);
+
+    int lines = (int)p.prog.size();
+    int spacing = max(1, lines / EDIT_CHECKPOINTS);
+    int frontier = pc - 1, last = pc;
+    vector<char> dirty(env.frame.size(), 0);
+    vector<int> written;
+    long long steps = 0;
+    Budget budget(env);
+    try {
+        while (pc >= 1 && pc <= lines) {
+            if (pc > frontier) {
+                if (pc - last >= spacing) {
+                    Checkpoint c;
+                    c.line = pc;
+                    c.steps = steps + (k < 0 ? 0 : p.checkpoints[k].steps);
+                    for (int s : written) { c.delta.push_back(make_pair(s, env.get_const(s))); dirty[s] = 0; }
+                    written.clear();
+                    p.checkpoints.push_back(move(c));
+                    last = pc;
+                }
+                frontier = pc;
+            }
+            int next = p.prog[pc - 1]->execute(env, pc, p.prog);
+            ++steps;
+            int w = p.writes[pc - 1];
+            if (w >= 0 && !dirty[w]) { dirty[w] = 1; written.push_back(w); }
+            if (next == -1) break; // HLT
+            if (next <= pc && budget.active && budget.due(steps)) budget.back_edge(next - 1, steps);
+            pc = next;
+        }
+    } catch (LimitExceeded &e) {
+        e.line = p.prog[pc - 1]->lineNo;
+        e.steps = steps;
+        throw;
+    } catch (const ListTooLong &e) {
+        throw runtime_error("Line " + to_string(p.prog[pc - 1]->lineNo) + ": " + e.what());
+    }
+    return steps;
+}
+
+static void configure_env(Env &env, const Options &opt) {
+    env.persistent_lists = opt.persistent;
+    env.big_ints = opt.big_ints;
+    env.arena.hashcons = opt.hashcons;
+    env.set_limits(opt.limits);
+}
+
+struct ServeSession {
+    const Options &opt;
+    map<unsigned long long, unique_ptr<ServedProgram>> programs;
+    map<string, unsigned long long> last_hash; // file -> hash of its text when last loaded
+    map<string, unique_ptr<EditedProgram>> edited; // rerun, by file
+    SymbolTable syms;
+    vector<Instruction*> lines;
+    Env env;
+
+    explicit ServeSession(const Options &o) : opt(o), env(syms) { configure_env(env, opt); }
+    ~ServeSession() { free_program(lines); }
+
+    ServedProgram &load(const string &file, unsigned long long &key) {
+        MappedFile src(file);
+        key = fnv1a(src.data, src.size);
+        last_hash[file] = key;
+        unique_ptr<ServedProgram> &slot = programs[key];
+        if (slot) return *slot;
+        unique_ptr<ServedProgram> p(new ServedProgram);
+        int level = opt.opt_level;
+        if (is_compiled(src.data, src.size)) {
+            if (opt.classic) throw runtime_error("compiled programs run on the bytecode engine only");
+            CompiledHeader h;
+            read_compiled(src.data, src.size, p->bc, p->syms, &h);
+            level = (int)h.opt_level;
+        } else {
+            build_program(opt, src, p->prog, p->syms, p->bc);
+        }
+        if (!opt.classic) {
+            free_program(p->prog); // lowered already
+            if (level > 0) specialize_checks(p->bc, p->syms, false, nullptr, nullptr, opt.big_ints);
+        }
+        p->env.reset(new Env(p->syms));
+        configure_env(*p->env, opt);
+        slot = move(p);
+        return *slot;
+    }
+
+    // A program by hash, or by file name when the text has not changed
+    ServedProgram &find(const string &ref) {
+        char *end;
+        unsigned long long key = strtoull(ref.c_str(), &end, 16);
+        if (ref.size() == 16 && !*end) {
+            auto it = programs.find(key);
+            if (it != programs.end()) return *it->second;
+        }
+        return load(ref, key);
+    }
+
+    // Write "id = value" for a defined identifier of env
+    static void put_ident(OutBuf &out, const Env &env, const SymbolTable &syms, const string &id) {
+        int slot = syms.find(id);
+        if (slot < 0 || !env.exists(slot)) throw runtime_error("Undefined identifier: " + id);
+        out.write(id);
+        out.write(" = ", 3);
+        write_value(out, env.get_const(slot), OUT_TEXT);
+        out.put('\n');
+    }
+
+    // A failed run becomes the request's error reply
+    static long long execute(const vector<Instruction*> &prog, const Bytecode &bc, Env &env, bool classic) {
+        try {
+            long long steps = classic ? exec_classic(prog, env) : try_bytecode(bc, env);
+            if (steps < 0) throw runtime_error(env.error_message());
+            return steps;
+        } catch (const LimitExceeded &e) {
+            throw runtime_error(string("limit exceeded: ") + e.what() + " at line " + to_string(e.line));
+        }
+    }
+
+    void run(const vector<string> &w) {
+        if (w.size() < 2) throw runtime_error("run needs a program");
+        ServedProgram &p = find(w[1]);
+        Env &penv = *p.env;
+        penv.reset();
+        long long steps = execute(p.prog, p.bc, penv, opt.classic);
+        reply_values(w, penv, p.syms);
+        cout << "ok " << steps << "\n";
+    }
+
+    // The dump after "run FILE", or the IDs after "run FILE ID..."
+    static void reply_values(const vector<string> &w, const Env &env, const SymbolTable &syms) {
+        if (w.size() == 2) {
+            print_env(env, cout);
+            return;
+        }
+        string reply; // whole, so an undefined ID leaves no partial answer
+        {
+            OutBuf out(reply);
+            for (size_t i = 2; i < w.size(); ++i) put_ident(out, env, syms, w[i]);
+        }
+        cout << reply;
+    }
+
+    // rerun FILE [ID...]: ok <steps> <line the run started from>
+    void rerun(const vector<string> &w) {
+        if (w.size() < 2) throw runtime_error("rerun needs a program");
+        string file = w[1];
+        unique_ptr<EditedProgram> &slot = edited[file];
+        if (!slot) {
+            slot.reset(new EditedProgram);
+            slot->env.reset(new Env(slot->syms));
+            configure_env(*slot->env, opt);
+        }
+        EditedProgram &p = *slot;
+        MappedFile src(file);
+        string text(src.data, src.size);
+        int k = -1;
+        if (text != p.text || p.prog.empty()) {
+            vector<Instruction*> prog = parse_program(text.data(), text.size(), p.syms);
+            int changed = p.prog.empty() ? 1 : first_changed_line(p.text, text);
+            while (k + 1 < (int)p.checkpoints.size() && p.checkpoints[k + 1].line <= changed) ++k;
+            free_program(p.prog);
+            p.prog = move(prog);
+            p.text = move(text);
+            p.writes.resize(p.prog.size());
+            for (size_t i = 0; i < p.prog.size(); ++i) p.writes[i] = written_slot(*p.prog[i]);
+            p.env->grow();
+        } else {
+            k = (int)p.checkpoints.size() - 1;
+        }
+        int from = k < 0 ? 1 : p.checkpoints[k].line;
+        long long steps;
+        try {
+            steps = exec_checkpointed(p, k);
+        } catch (const LimitExceeded &e) {
+            throw runtime_error(string("limit exceeded: ") + e.what() + " at line " + to_string(e.line));
+        }
+        reply_values(w, *p.env, p.syms);
+        cout << "ok " << steps << " " << from << "\n";
+    }
+
+    void exec(const char *p, const char *end) {
+        Tokens t;
+        tokenize(p, end, t);
+        int lineno = (int)lines.size() + 1;
+        Instruction *ins = parse_line(t, lineno, syms);
+        lines.push_back(ins ? ins : new Instr_NOP(lineno));
+        env.grow();
+        env.start_pc = lineno - 1;
+        // bytecode is built per program, so session lines run on the classic engine
+        long long steps = execute(lines, Bytecode(), env, true);
+        cout << "ok " << steps << "\n";
+    }
+
+    // One request; false on quit
+    bool handle(const char *p, const char *end) {
+        vector<string> w;
+        for (const char *q = p; q < end;) {
+            while (q < end && is_space(*q)) ++q;
+            const char *b = q;
+            while (q < end && !is_space(*q)) ++q;
+            if (q > b) w.push_back(string(b, q));
+        }
+        if (w.empty()) return true;
+        const string &cmd = w[0];
+        try {
+            if (cmd == "quit") return false;
+            if (cmd == "load") {
+                if (w.size() != 2) throw runtime_error("load needs one file");
+                unsigned long long key;
+                ServedProgram &sp = load(w[1], key);
+                char hex[17];
+                snprintf(hex, sizeof hex, "%016llx", key);
+                cout << "ok " << hex << " " << sp.syms.size() << "\n";
+            } else if (cmd == "run") {
+                run(w);
+            } else if (cmd == "rerun") {
+                rerun(w);
+            } else if (cmd == "exec") {
+                while (is_space(*p)) ++p;
+                exec(p + cmd.size(), end);
+            } else if (cmd == "get") {
+                if (w.size() != 2) throw runtime_error("get needs one identifier");
+                {
+                    OutBuf out(cout);
+                    put_ident(out, env, syms, w[1]);
+                }
+                cout << "ok\n";
+            } else if (cmd == "dump") {
+                print_env(env, cout);
+                cout << "ok\n";
+            } else if (cmd == "reset") {
+                env.reset();
+                free_program(lines);
+                cout << "ok\n";
+            } else {
+                throw runtime_error("Unknown request: " + cmd);
+            }
+        } catch (const exception &e) {
+            cout << "error " << e.what() << "\n";
+        }
+        cout.flush();
+        return true;
+    }
+};
+
+static int run_serve(const Options &opt) {
+    ServeSession session(opt);
+    string line;
+    while (getline(cin, line))
+        if (!session.handle(line.data(), line.data() + line.size())) break;
+    return 0;
+}
+
+// CLI
+int main(int argc, char **argv) {
+    Options opt;
+    if (!parse_args(argc, argv, opt)) {
+        cerr << "Usage: ppl [--engine=bytecode|classic] [--lists=persistent|copy|hashcons] [--ints=wrap|big] [--arena-stats] [--profile] [-O0|-O1|-O2] [--cache[=DIR]] [--output=text|json|binary] [--bench N] <program-file>\n"
+             << "       ppl --compile [-O0|-O1|-O2] <program-file> [-o <output.pplc>]\n"
+             << "       ppl --check [-O0|-O1|-O2] <program-file>\n"
+             << "       ppl --emit-cpp [-O0|-O1] <program-file> [-o <output.cpp>]\n"
+             << "  limits: [--max-steps=N] [--max-memory=BYTES[K|M|G]] [--timeout=SECONDS]\n"
+             << "  snapshots: [--snapshot FILE [--snapshot-every=SECONDS]] [--resume FILE]\n"
+             << "       ppl --batch <jobs-file> [-j N] [engine, list, int and -O options]\n"
+             << "  tracing: [--trace=N [--trace-file=PATH]]\n"
+             << "       ppl --decode-trace <trace-file> [engine and -O options] <program-file>\n"
+             << "       ppl --serve [engine, list, int, -O and limit options]\n";
+        return 1;
+    }
+    if (opt.compile) return run_compile(opt);
+    if (opt.check) return run_check(opt);
+    if (opt.emit_cpp) return run_emit_cpp(opt);
+    if (!opt.batch.empty()) return run_batch(opt);
+    if (opt.serve) return run_serve(opt);
+    if (!opt.decode_trace.empty()) return run_decode_trace(opt);
+    if (opt.bench_runs > 0) return run_bench(opt);
+    vector<Instruction*> prog;
+    SymbolTable syms;
+    Bytecode bc;
+    int level;
+    try {
+        //Loads PPL instructions into prog Instruction* vector (or a compiled program into bc), giving each identifier a slot.
+        load_image(opt, prog, syms, bc, nullptr, &level);
+    } catch (const exception &e) {
+        cerr << "Error loading program: " << e.what() << endl;
+        free_program(prog);
+        return 1;
+    }
+    Env env(syms);
+    env.persistent_lists = opt.persistent;
+    env.big_ints = opt.big_ints;
+    env.arena.hashcons = opt.hashcons;
+    env.set_limits(opt.limits);
+    SnapshotConfig snap;
+    if (!opt.snapshot.empty() || !opt.resume.empty()) {
+        snap.engine = opt.classic ? SNAP_CLASSIC : SNAP_BYTECODE;
+        snap.program = opt.classic ? program_hash(prog, syms) : program_hash(bc.code, syms);
+    }
+    // hashed like a snapshot, before the checks are specialized
+    unique_ptr<Trace> trace;
+    if (opt.trace > 0) {
+        trace.reset(new Trace((size_t)opt.trace));
+        trace->path = opt.trace_file;
+        trace->engine = opt.classic ? SNAP_CLASSIC : SNAP_BYTECODE;
+        trace->program = opt.classic ? program_hash(prog, syms) : program_hash(bc.code, syms);
+    }
+    if (!opt.resume.empty()) {
+        try {
+            MappedFile f(opt.resume);
+            int pc_limit = opt.classic ? (int)prog.size() + 1 : (int)bc.code.size();
+            env.start_pc = read_snapshot(f.data, f.size, env, snap.engine, snap.program, pc_limit);
+        } catch (const exception &e) {
+            cerr << "Error loading snapshot: " << e.what() << endl;
+            free_program(prog);
+            return 1;
+        }
+    }
+    // after the snapshot: the analysis starts from the resumed state
+    if (!opt.classic && level > 0) specialize_checks(bc, syms, false, nullptr, &env, opt.big_ints);
+    if (!opt.snapshot.empty()) {
+        snap.path = opt.snapshot;
+        snap.every = opt.snapshot_every;
+        env.snapshot = &snap;
+        signal(SIGTERM, on_suspend_signal);
+        signal(SIGINT, on_suspend_signal);
+    }
+    if (trace) {
+        if (opt.classic) trace->init(prog);
+        else trace->init(bc.code);
+        trace->bind(env);
+        env.trace = trace.get();
+        signal_trace = trace.get();
+        for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGABRT, SIGUSR1}) signal(sig, on_trace_signal);
+        if (opt.snapshot.empty()) {
+            signal(SIGTERM, on_trace_signal);
+            signal(SIGINT, on_trace_signal);
+        }
+    }
+    Profile profile;
+    Profile *prof = opt.profile ? &profile : nullptr;
+    //Runs program using the selected engine and the loaded instructions.
+    RunStatus status;
+    if (opt.classic) {
+        if (prof) prof->init(prog);
+        status = run_program(prog, env, prof, cout, cerr, opt.format);
+    } else {
+        if (prof) prof->init(bc.code);
+        status = run_bytecode(bc, env, prof, cout, cerr, opt.format);
+    }
+    if (prof) prof->report(cerr);
+    if (opt.arena_stats) print_arena_stats(env.arena, cerr);
+    snap.wait();
+    //Clears the instructions (if re-use were to be desired)
+    free_program(prog);
+    return status == RUN_LIMIT ? 2 : status == RUN_SUSPENDED ? 3 : 0;
+}
+#endif
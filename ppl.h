@@ -0,0 +1,152 @@
+// Embedding API for the PPL interpreter. Compile main.cpp with -DPPL_NO_MAIN
+// and link it into the host program.
+//
+//   auto prog = ppl::Program::load("prog.ppl");
+//   ppl::Context ctx(prog);
+//   ctx.set_int(prog->slot("n"), 10);
+//   if (ctx.run()) { long long r = ctx.get_int(prog->slot("r")); }
+//   ctx.reset(); // ready for the next input, arena memory kept
+#ifndef PPL_H
+#define PPL_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ppl {
+
+struct ProgramData;
+struct ContextData;
+
+// A parsed, optimized and lowered program. Immutable once built, so one
+// Program can back any number of Contexts on any number of threads.
+class Program {
+public:
+    // Load a .ppl source file or a compiled .pplc; throws std::runtime_error
+    static std::shared_ptr<const Program> load(const std::string &file, int opt_level = 2);
+    // Build from program text held in memory; throws std::runtime_error
+    static std::shared_ptr<const Program> parse(const std::string &text, int opt_level = 2);
+    // Load a shared object built from ppl --emit-cpp output. Contexts then run
+    // the generated code; throws std::runtime_error
+    static std::shared_ptr<const Program> load_native(const std::string &so_file);
+    ~Program();
+
+    // Slot of an identifier the program mentions, -1 if it never does
+    int slot(const std::string &name) const;
+    int slots() const;
+    const std::string &name(int slot) const;
+
+    const ProgramData &data() const { return *d; }
+
+private:
+    Program();
+    std::unique_ptr<ProgramData> d;
+};
+
+// Mutable state for running one Program: the slot frame and its list arena.
+// A Context is used by one thread at a time.
+class Context {
+public:
+    explicit Context(std::shared_ptr<const Program> prog);
+    ~Context();
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+    // Undefine every identifier. The arena keeps its slabs for the next run.
+    void reset();
+
+    // Seed inputs before run(). A seeded identifier counts as declared, so
+    // the program must read it without an INTEGER/LIST of its own.
+    void set_int(int slot, long long v);
+    void set_list(int slot, const long long *items, size_t n); // head first
+    void set_list(int slot, const std::vector<long long> &items) { set_list(slot, items.data(), items.size()); }
+
+    // Run the program once. On a runtime error returns false and stores the
+    // message (as printed by the ppl binary, without the prefix) in *error.
+    bool run(std::string *error = nullptr);
+    long long steps() const; // instructions executed by the last run()
+
+    // Stop later runs after max_steps instructions, max_memory bytes of list
+    // storage or timeout seconds (0: no limit). run() then returns false with
+    // "limit exceeded: ..." and the slots keep their values at that point.
+    void set_limits(long long max_steps, size_t max_memory = 0, double timeout = 0);
+
+    bool defined(int slot) const;
+    bool is_int(int slot) const;
+    bool is_list(int slot) const;
+    // Throws std::runtime_error unless the slot holds an int
+    long long get_int(int slot) const;
+    // Copy a list of ints, head first; false if undefined, not a list, or nested
+    bool get_list(int slot, std::vector<long long> &out) const;
+    // The value as the final dump prints it
+    std::string to_string(int slot) const;
+
+private:
+    std::shared_ptr<const Program> prog;
+    std::unique_ptr<ContextData> d;
+};
+
+// Interface between the host and code generated by ppl --emit-cpp. The host
+// hands its runtime to the generated function, so the shared object links
+// against nothing and every list instruction runs in the interpreter itself.
+namespace native {
+
+const unsigned ABI_VERSION = 3;
+
+struct Frame; // one run: the Context's slots and arena, and its limits
+
+// Each instruction call performs the interpreter's checks and throws its
+// std::runtime_error ("Line N: ...") on failure.
+struct Runtime {
+    void (*integer)(Frame &, int x, int line);
+    void (*list)(Frame &, int x, int line);
+    void (*merge)(Frame &, int a, int l, int line);
+    void (*copy)(Frame &, int a, int b, int line);
+    void (*head)(Frame &, int l, int x, int line);
+    void (*tail)(Frame &, int a, int b, int line);
+    void (*pop)(Frame &, int l, int x, int line);
+    void (*len)(Frame &, int l, int x, int line);
+    void (*sum)(Frame &, int l, int x, int line);
+    void (*range)(Frame &, int n, int l, int line);
+    void (*fill)(Frame &, int x, int l, int line);
+    void (*reverse)(Frame &, int l, int line);
+    void (*concat)(Frame &, int a, int l, int line);
+    void (*assign)(Frame &, int x, long long v, int line);
+    void (*chs)(Frame &, int x, int line);
+    void (*add)(Frame &, int a, int b, int line);
+    void (*sub)(Frame &, int a, int b, int line, int add_line);
+    bool (*if_zero)(Frame &, int x, int line); // the IF test, without the jump
+    // Slots the generated code keeps in locals. load_int fails if x holds a list.
+    bool (*load_int)(Frame &, int x, long long *v, bool *defined);
+    void (*store_int)(Frame &, int x, long long v, bool defined);
+    // Throws "Line N: " + msg (+ the slot's name unless slot is -1)
+    void (*fail)(Frame &, int line, const char *msg, int slot);
+    // Limits: back_edge is only called when limited() says so
+    bool (*limited)(Frame &);
+    void (*back_edge)(Frame &, int target, long long steps, int line);
+};
+
+// Instructions executed, or -1 before doing anything to leave the run to the interpreter
+typedef long long (*RunFn)(Frame &, const Runtime &);
+
+// Exported by the generated code as ppl_native_module
+struct Module {
+    unsigned abi;                    // ABI_VERSION
+    const char *source;              // the program text, rebuilt by load_native
+    size_t source_size;
+    int opt_level;
+    unsigned long long program_hash; // of the code run was generated from
+    RunFn run;
+};
+
+// PPL arithmetic wraps modulo 2^64
+inline long long wrap_add(long long a, long long b) { return (long long)((unsigned long long)a + (unsigned long long)b); }
+inline long long wrap_sub(long long a, long long b) { return (long long)((unsigned long long)a - (unsigned long long)b); }
+inline long long wrap_neg(long long a) { return (long long)(0 - (unsigned long long)a); }
+
+} // namespace native
+
+} // namespace ppl
+
+#endif
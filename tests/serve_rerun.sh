@@ -0,0 +1,48 @@
+#!/bin/sh
+# Reruns a list-building program through --serve, edits it, reruns it and
+# quits. Checks that the session exits cleanly and that the edited rerun
+# matches a fresh run. Usage: tests/serve_rerun.sh [path-to-ppl]
+PPL=${1:-./ppl}
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+PROG="$DIR/rerun.ppl"
+
+gen() {
+    awk -v n=300 -v last="$1" 'BEGIN {
+        print "LIST l"
+        for (i = 1; i <= n; i++) {
+            print "ASSIGN a" i " " (i == n ? last : i)
+            print "MERGE a" i " l"
+        }
+        print "LEN l k"
+    }'
+}
+
+status=0
+for opts in "" "--engine=classic" "--lists=copy" "--lists=hashcons"; do
+    gen 300 > "$PROG"
+    printf 'rerun %s l k\n' "$PROG" > "$DIR/first"
+    printf 'rerun %s l k\nquit\n' "$PROG" > "$DIR/second"
+    {
+        cat "$DIR/first"
+        # The edit lands after the request above is read; serve handles one line at a time
+        sleep 1
+        gen 7 > "$PROG"
+        cat "$DIR/second"
+    } | "$PPL" --serve $opts > "$DIR/out" 2>&1
+    rc=$?
+    "$PPL" $opts "$PROG" | grep -E '^(l|k) = ' | sort > "$DIR/fresh"
+    # Second rerun: its dump lines, then "ok <steps> <line>" with line past 1
+    sed -n '/^ok /,$p' "$DIR/out" | sed '1d' | grep -E '^(l|k) = ' | sort > "$DIR/rerun"
+    last=$(tail -n 1 "$DIR/out")
+    if [ $rc -ne 0 ]; then
+        echo "FAIL ${opts:-default}: --serve exited with $rc"; status=1
+    elif ! cmp -s "$DIR/fresh" "$DIR/rerun"; then
+        echo "FAIL ${opts:-default}: rerun after edit differs from a fresh run"; status=1
+    elif [ "$(echo "$last" | awk '{print $1, ($3 > 1)}')" != "ok 1" ]; then
+        echo "FAIL ${opts:-default}: rerun did not resume from a checkpoint: $last"; status=1
+    else
+        echo "ok ${opts:-default}"
+    fi
+done
+exit $status